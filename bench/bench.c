@@ -0,0 +1,415 @@
+// Loopback benchmark of the link layer.
+// Runs a transmitter and a receiver in two processes joined by a pair of
+// pseudo-terminals. The parent relays bytes between them through the channel
+// models of the virtual cable (baud rate, seeded noise, dropouts and delay),
+// and prints the results as one line of JSON.
+// With another transport the two processes are connected directly, and the
+// link runs as fast as the transport allows.
+
+#define _GNU_SOURCE
+
+#include "channel.h"
+#include "link_layer.h"
+#include "transport.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RELAY_CHUNK 4096       // Bytes forwarded at once, at most
+#define RELAY_TICK 1000000LL   // ns of line time read ahead from the sender
+
+// Benchmark parameters
+struct Parameters {
+    int baudRate;
+    long long totalBytes;
+    int payloadSize;  // Bytes per llwrite
+    ChannelConfig channel; // Applied in both directions
+    int timeout;
+    int nRetransmissions;
+    unsigned int seed;
+    const char *transport;
+};
+
+struct Parameters par = {
+    .baudRate = 9600,
+    .totalBytes = 16384,
+    .payloadSize = MAX_PAYLOAD_SIZE,
+    .timeout = 1,
+    .nRetransmissions = 3,
+    .seed = 1,
+    .transport = "relay"};
+
+// Sent from each child to the parent once its side of the link is closed
+typedef struct {
+    int ok;
+    double elapsed;     // Seconds spent in llwrite (transmitter only)
+    long long bytes;    // Payload bytes sent or received
+    int corrupted;      // Packets delivered with errors BCC2 did not catch
+    LinkStats stats;
+} Result;
+
+typedef struct {
+    int from;
+    int to;
+    Channel channel;
+} Relay;
+
+static long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double now()
+{
+    return nowNs() / 1e9;
+}
+
+// Synthetic payload; both sides generate the same bytes from the seed.
+static unsigned char *makePayload(long long size, unsigned int seed)
+{
+    unsigned char *data = malloc(size);
+    if (data == NULL) return NULL;
+    unsigned int x = seed ? seed : 1;
+    for (long long i = 0; i < size; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = (unsigned char) x;
+    }
+    return data;
+}
+
+// Open a pseudo-terminal in raw mode, storing the slave device name in name.
+// Return the master fd, or -1 on error.
+static int openPty(char *name, int nameSize, int *slave)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1) return -1;
+    if (grantpt(master) == -1 || unlockpt(master) == -1 ||
+        ptsname_r(master, name, nameSize) != 0) {
+        close(master);
+        return -1;
+    }
+
+    // Held open so that the master does not see a hangup between the
+    // moments the child opens and closes the slave
+    *slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (*slave == -1 || tcgetattr(*slave, &tio) == -1) {
+        close(master);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+    return master;
+}
+
+// Forward bytes from one master to the other through a channel model.
+static void *relayThread(void *arg)
+{
+    Relay *relay = arg;
+    Channel *ch = &relay->channel;
+    unsigned char buf[RELAY_CHUNK];
+
+    while (TRUE) {
+        long long t = nowNs();
+        int n = channelReceive(ch, buf, sizeof(buf), t);
+        if (n > 0 && write(relay->to, buf, n) != n) return NULL;
+
+        // Only read what the line can carry soon; the rest waits in the pty
+        int room = channelRoom(ch, t, RELAY_TICK);
+        long long wake = channelNextArrival(ch);
+        // Otherwise wake when the next byte fits
+        long long fits = ch->lineFree - RELAY_TICK + ch->byteTime;
+        if (room == 0 && (wake < 0 || fits < wake)) wake = fits;
+
+        struct pollfd pfd = {relay->from, room > 0 ? POLLIN : 0, 0};
+        struct timespec timeout = {0, 0};
+        if (wake > t) {
+            timeout.tv_sec = (wake - t) / 1000000000LL;
+            timeout.tv_nsec = (wake - t) % 1000000000LL;
+        }
+        if (ppoll(&pfd, 1, wake < 0 ? NULL : &timeout, NULL) == -1) return NULL;
+
+        if (pfd.revents & POLLIN) {
+            n = read(relay->from, buf, room < RELAY_CHUNK ? room : RELAY_CHUNK);
+            if (n <= 0) return NULL;
+            channelSend(ch, buf, n, nowNs(), NULL);
+        }
+        else if (pfd.revents & (POLLHUP | POLLERR)) return NULL;
+    }
+    return NULL;
+}
+
+static LinkLayer linkParameters(const char *port, LinkLayerRole role)
+{
+    LinkLayer ll;
+    memset(&ll, 0, sizeof(ll));
+    strncpy(ll.serialPort, port, sizeof(ll.serialPort) - 1);
+    ll.role = role;
+    ll.baudRate = par.baudRate;
+    ll.nRetransmissions = par.nRetransmissions;
+    ll.timeout = par.timeout;
+    return ll;
+}
+
+static Result runTransmitter(const char *port)
+{
+    Result result = {0};
+    LinkLayer ll = linkParameters(port, LlTx);
+    unsigned char *data = makePayload(par.totalBytes, par.seed);
+
+    // Give the receiver time to open its port, which discards pending input
+    usleep(200000);
+    if (data == NULL || llopen(ll) == -1) {
+        free(data);
+        return result;
+    }
+
+    result.ok = TRUE;
+    double start = now();
+    for (long long offset = 0; offset < par.totalBytes; offset += par.payloadSize) {
+        int size = par.totalBytes - offset < par.payloadSize ? par.totalBytes - offset : par.payloadSize;
+        if (llwrite(data + offset, size) == -1) {
+            result.ok = FALSE;
+            break;
+        }
+        result.bytes += size;
+    }
+    result.elapsed = now() - start;
+
+    llstats(&result.stats);
+    if (llclose(ll) == -1) result.ok = FALSE;
+    free(data);
+    return result;
+}
+
+static Result runReceiver(const char *port)
+{
+    Result result = {0};
+    LinkLayer ll = linkParameters(port, LlRx);
+    unsigned char *data = makePayload(par.totalBytes, par.seed);
+    unsigned char *packet = malloc(MAX_PAYLOAD_SIZE);
+
+    if (data == NULL || packet == NULL || llopen(ll) == -1) {
+        free(data);
+        free(packet);
+        return result;
+    }
+
+    result.ok = TRUE;
+    int size;
+    while ((size = llread(packet)) > 0) {
+        if (result.bytes + size > par.totalBytes ||
+            memcmp(packet, data + result.bytes, size) != 0) result.corrupted++;
+        result.bytes += size;
+    }
+    if (size == -1 || result.bytes != par.totalBytes || result.corrupted) result.ok = FALSE;
+
+    if (llclose(ll) == -1) result.ok = FALSE;
+    llstats(&result.stats);
+    free(data);
+    free(packet);
+    return result;
+}
+
+// Run one side of the link in a child process, with its console output
+// discarded. Return the child pid, or -1 on error.
+static pid_t spawn(const char *port, LinkLayerRole role, int *resultFd)
+{
+    int fds[2];
+    if (pipe(fds) == -1) return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        if (freopen("/dev/null", "w", stdout) == NULL) _exit(1);
+        Result result = role == LlTx ? runTransmitter(port) : runReceiver(port);
+        _exit(write(fds[1], &result, sizeof(result)) == sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+    *resultFd = fds[0];
+    return pid;
+}
+
+static int readResult(int fd, Result *result)
+{
+    memset(result, 0, sizeof(*result));
+    int res = read(fd, result, sizeof(*result));
+    close(fd);
+    return res == sizeof(*result) ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-b baudrate] [-n bytes] [-s payload] [-e byte_error_rate]\n"
+           "          [-g p_gb,p_bg,good_byte_er,bad_byte_er] [-D period_ms,length_ms]\n"
+           "          [-d delay_us] [-t timeout] [-r retransmissions] [-S seed]\n"
+           "          [-T relay|pty|socketpair|unix|udp|mem]\n", prog);
+}
+
+// Arguments:
+//   -b: simulated baud rate (9600)
+//   -n: total payload bytes to transfer (16384)
+//   -s: bytes per llwrite call (MAX_PAYLOAD_SIZE)
+//   -e: probability of corrupting each byte on the line (0)
+//   -g: Gilbert-Elliott burst errors instead: transition probabilities per
+//       byte and byte error rates of the good and bad states
+//   -D: cut the line for length ms every period ms (never)
+//   -d: propagation delay in usec (0)
+//   -t: link timeout in seconds (1)
+//   -r: number of tries per frame (3)
+//   -S: seed of the payload and of the channels (1)
+//   -T: transport (relay); only the relay goes through the channel models
+int main(int argc, char *argv[])
+{
+    int opt;
+    long long dropPeriod = 0, dropLength = 0;
+    par.channel = channelDefaultConfig();
+    while ((opt = getopt(argc, argv, "b:n:s:e:g:D:d:t:r:S:T:")) != -1) {
+        switch (opt) {
+        case 'b': par.baudRate = atoi(optarg); break;
+        case 'n': par.totalBytes = atoll(optarg); break;
+        case 's': par.payloadSize = atoi(optarg); break;
+        case 'e':
+            par.channel.model = ErrorBernoulli;
+            par.channel.byteER = atof(optarg);
+            break;
+        case 'g':
+            par.channel.model = ErrorGilbertElliott;
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &par.channel.pGoodToBad, &par.channel.pBadToGood,
+                       &par.channel.goodER, &par.channel.badER) != 4) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'D':
+            if (sscanf(optarg, "%lld,%lld", &dropPeriod, &dropLength) != 2 || dropLength > dropPeriod) {
+                usage(argv[0]);
+                return 2;
+            }
+            par.channel.dropPeriod = dropPeriod * 1000000LL;
+            par.channel.dropLength = dropLength * 1000000LL;
+            break;
+        case 'd': par.channel.delay = atoll(optarg) * 1000LL; break;
+        case 't': par.timeout = atoi(optarg); break;
+        case 'r': par.nRetransmissions = atoi(optarg); break;
+        case 'S': par.seed = strtoul(optarg, NULL, 0); break;
+        case 'T': par.transport = optarg; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (par.baudRate <= 0 || par.totalBytes < 0 || par.payloadSize <= 0 ||
+        par.payloadSize > MAX_PAYLOAD_SIZE || par.timeout <= 0 || par.nRetransmissions <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    par.channel.baudRate = par.baudRate;
+
+    char txPort[64], rxPort[64];
+    int txMaster = -1, rxMaster = -1;
+    int relay = strcmp(par.transport, "relay") == 0;
+    if (relay) {
+        int txSlave, rxSlave;
+        txMaster = openPty(txPort, sizeof(txPort), &txSlave);
+        rxMaster = openPty(rxPort, sizeof(rxPort), &rxSlave);
+        if (txMaster == -1 || rxMaster == -1) {
+            perror("openpty");
+            return 1;
+        }
+    } else if (strcmp(par.transport, "pty") == 0) {
+        // The receiver creates the pseudo-terminal, the transmitter opens its slave
+        snprintf(rxPort, sizeof(rxPort), "pty:/tmp/bench-%d.pty", getpid());
+        snprintf(txPort, sizeof(txPort), "/tmp/bench-%d.pty", getpid());
+    } else if (strcmp(par.transport, "socketpair") == 0) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+            perror("socketpair");
+            return 1;
+        }
+        snprintf(txPort, sizeof(txPort), "fd:%d", sv[0]);
+        snprintf(rxPort, sizeof(rxPort), "fd:%d", sv[1]);
+    } else if (strcmp(par.transport, "unix") == 0) {
+        snprintf(txPort, sizeof(txPort), "unix:/tmp/bench-%d.sock", getpid());
+        snprintf(rxPort, sizeof(rxPort), "unix:/tmp/bench-%d.sock", getpid());
+    } else if (strcmp(par.transport, "udp") == 0) {
+        int port = 20000 + getpid() % 20000 * 2;
+        snprintf(txPort, sizeof(txPort), "udp:%d:%d", port, port + 1);
+        snprintf(rxPort, sizeof(rxPort), "udp:%d:%d", port + 1, port);
+    } else if (strcmp(par.transport, "mem") == 0) {
+        if (memPipeCreate() == -1) {
+            perror("mmap");
+            return 1;
+        }
+        strcpy(txPort, "mem:0");
+        strcpy(rxPort, "mem:1");
+    } else {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int rxFd, txFd;
+    pid_t rxPid = spawn(rxPort, LlRx, &rxFd);
+    pid_t txPid = spawn(txPort, LlTx, &txFd);
+    if (rxPid == -1 || txPid == -1) {
+        perror("fork");
+        return 1;
+    }
+
+    // Seeded as the cable seeds its two directions
+    Relay toRx = {txMaster, rxMaster};
+    Relay toTx = {rxMaster, txMaster};
+    pthread_t t1, t2;
+    if (relay) {
+        if (channelInit(&toRx.channel, &par.channel, (uint64_t) par.seed * 2) == -1 ||
+            channelInit(&toTx.channel, &par.channel, (uint64_t) par.seed * 2 + 1) == -1) {
+            perror("channelInit");
+            return 1;
+        }
+        pthread_create(&t1, NULL, relayThread, &toRx);
+        pthread_create(&t2, NULL, relayThread, &toTx);
+    }
+
+    Result tx, rx;
+    int txOk = readResult(txFd, &tx) == 0 && tx.ok;
+    // The receiver only gives up by itself if the transmitter's DISC got lost
+    if (!txOk) kill(rxPid, SIGTERM);
+    int rxOk = readResult(rxFd, &rx) == 0 && rx.ok;
+    waitpid(txPid, NULL, 0);
+    waitpid(rxPid, NULL, 0);
+
+    double goodput = tx.elapsed > 0 ? rx.bytes * 8 / tx.elapsed : 0;
+    // Only the relay paces the link at the baud rate; unpaced transports
+    // have no nominal rate to compare with
+    char efficiency[32] = "null";
+    if (relay) snprintf(efficiency, sizeof(efficiency), "%.4f", goodput / par.baudRate);
+    printf("{\"ok\": %s, \"transport\": \"%s\", \"baud_rate\": %d, \"bytes\": %lld, \"payload_size\": %d, "
+           "\"seed\": %u, \"seconds\": %.6f, \"goodput_bps\": %.1f, "
+           "\"efficiency\": %s, \"frames_sent\": %d, \"wire_bytes\": %lld, "
+           "\"retransmissions\": %d, \"timeouts\": %d, \"rej_received\": %d, "
+           "\"frames_received\": %d, \"rej_sent\": %d, \"duplicates\": %d, "
+           "\"corrupted_packets\": %d, \"line_bytes_corrupted\": %lld, \"line_bytes_dropped\": %lld}\n",
+           txOk && rxOk ? "true" : "false", par.transport, par.baudRate, rx.bytes, par.payloadSize,
+           par.seed, tx.elapsed, goodput, efficiency,
+           tx.stats.framesSent, tx.stats.bytesSent, tx.stats.retransmissions,
+           tx.stats.timeouts, tx.stats.rejReceived, rx.stats.framesReceived,
+           rx.stats.rejSent, rx.stats.duplicates, rx.corrupted,
+           toRx.channel.bytesCorrupted + toTx.channel.bytesCorrupted,
+           toRx.channel.bytesDropped + toTx.channel.bytesDropped);
+
+    return txOk && rxOk ? 0 : 1;
+}
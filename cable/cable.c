@@ -1,26 +1,38 @@
 // Virtual cable program to test serial port.
-// Creates a pair of virtual Tx / Rx serial ports using "socat".
+// Creates pairs of virtual Tx / Rx serial ports using "socat", one per cable.
 //
 // Author: Manuel Ricardo [mricardo@fe.up.pt]
 // Modified by: Eduardo Nuno Almeida [enalmeida@fe.up.pt]
 // Modified by: Rui Prior [rcprior@fc.up.pt]
 
+#include "channel.h"
+#include "fault.h"
+#include "pacer.h"
+#include "trace.h"
+
+#include <errno.h>
 #include <fcntl.h>
 #include <math.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+// Cable i > 0 uses /dev/ttyS<10 + 2i>, /dev/ttyS<11 + 2i>, and the emulator
+// ports with i appended
 #define TXDEV "/dev/ttyS10"
 #define RXDEV "/dev/ttyS11"
 #define TX_EMULATOR "/dev/emulatorTx"
 #define RX_EMULATOR "/dev/emulatorRx"
+#define DEV_NUMBER 10
+#define MAX_CABLES 8
 
 // Baudrate settings are defined in <asm/termbits.h>, which is
 // included by <termios.h>
@@ -31,32 +43,90 @@
 #define TRUE 1
 
 #define BUF_SIZE 2048
+#define TICK_NSEC 1000000   // Bytes are moved in batches, once per tick
+
+#define DEFAULT_SEED 1
+
+#define MAX_STEPS 1024      // Scenario steps
+#define CMD_SIZE 128
+
+// Traffic counters of a cable at some time; index 0 is Tx->Rx and 1 is Rx->Tx
+struct Counters {
+    long long time;
+    long long read[2];
+    long long sent[2];       // Put on the line
+    long long delivered[2];
+    long long off[2];
+    long long corrupted[2];
+    long long dropped[2];
+    long long faults[2];
+};
+
+// One cable: a pair of serial ports and the line between them
+struct Cable {
+    int id;
+    char txDev[32];
+    char rxDev[32];
+    char txEmulator[32];
+    char rxEmulator[32];
+    int fdTx;
+    int fdRx;
+    struct termios oldtioTx;
+    struct termios oldtioRx;
+    int cableOn;
+    ChannelConfig channel;  // Applied to both directions
+    uint64_t seed;
+    Channel tx2rx;
+    Channel rx2tx;
+    int backlog[2];         // The last batch of tx2rx/rx2tx filled the line
+    Faults faults[2];        // Targeted faults; index 0 is Tx->Rx and 1 is Rx->Tx
+    long long faultsShown[2];
+    int logging;
+    int logIdle;            // The trace already shows the line idle
+    Trace trace;
+    // Traffic, for the summary; index 0 is Tx->Rx and 1 is Rx->Tx
+    long long bytesRead[2];
+    long long bytesWritten[2];
+    long long bytesOff[2];   // Discarded while the cable was off
+    struct Counters reported; // At the last periodic report
+};
 
 // Current running parameters
 struct Parameters {
-    int cableOn;
-    double byteER;   // Byte error rate
-    struct timespec byteDelay;
-    unsigned long propDelay;   // Desired propagation delay in usec
-    int bufSize;  // Dimensioned to enforce the propagation delay
-    char *tx2rx;
-    char *tx2rxValid;  // TRUE if corresponding entry holds a byte
-    long tx2rxIdx;     // Input index for the tx2rx buffer
-    char *rx2tx;
-    char *rx2txValid;  // TRUE if corresponding entry holds a byte
-    long rx2txIdx;     // Input index for the tx2rx buffer
-    FILE *logfile;
+    struct Cable cables[MAX_CABLES];
+    int nCables;
+    struct Cable *selected;  // The cable that line commands apply to
+    Pacer pacer;             // Ticks at the shortest tick of all cables
+    long long firstByte;     // Time of the first byte read on any cable, or -1
+    long long lastActivity;  // Last time a byte was read or was in flight
+    // Virtual time: the cable clock runs ahead of the real one by skipped ns
+    int virtualTime;
+    long long skipped;
+    // Periodic statistics (0: none), and the pacer at the last report
+    long long statsPeriod;
+    long long nextStats;
+    long long reportedWakeups;
+    long long reportedLate;
+    long long reportedSkips;
 };
 
 struct Parameters par = {
-    .cableOn = TRUE,
-    .byteER = 0.0,
-    .propDelay = 0,
-    .tx2rx = NULL,
-    .tx2rxValid = NULL,
-    .rx2tx = NULL,
-    .rx2txValid = NULL,
-    .logfile = NULL};
+    .nCables = 1,
+    .firstByte = -1,
+    .virtualTime = FALSE,
+    .skipped = 0};
+
+// Timed commands read from a scenario file
+struct Scenario {
+    int nSteps;
+    int next;                   // Next step to run
+    long long at[MAX_STEPS];    // ns after the first byte (0: at startup)
+    char command[MAX_STEPS][CMD_SIZE];
+    long long idleQuit;         // After the last step, quit once the line was idle this long (-1: at once)
+    long long end;              // When the last step ran
+};
+
+struct Scenario scenario = {.nSteps = 0, .idleQuit = -1};
 
 // Returns: serial port file descriptor (fd).
 int openSerialPort(const char *serialPort, struct termios *oldtio, struct termios *newtio)
@@ -86,52 +156,54 @@ int openSerialPort(const char *serialPort, struct termios *oldtio, struct termio
 }
 
 
-// Add noise to a buffer, by flipping the byte in the "errorIndex" position.
-void addNoiseToBuffer(unsigned char *buf, size_t errorIndex)
+// Apply the channel parameters to both directions, keeping bytes in flight
+void apply_channel_config(struct Cable *c)
 {
-    buf[errorIndex] ^= 0xFF;
+    channelSetConfig(&c->tx2rx, &c->channel);
+    channelSetConfig(&c->rx2tx, &c->channel);
 }
 
 
-// Initialize the ring buffers that implement the propagation delay
-// Returns 0 on success, -1 on failure
-int init_ring_buffers(void)
+// Restart the error sequences of both directions
+void seed_channels(struct Cable *c, uint64_t seed)
 {
-    long nsecPropDelay = 1000 * par.propDelay;
-    long bytesInFlight = nsecPropDelay / par.byteDelay.tv_nsec;
-    // Round instead of truncating
-    if (nsecPropDelay % par.byteDelay.tv_nsec > par.byteDelay.tv_nsec / 2)
-    {
-        ++bytesInFlight;
-    }
-    long actualPropDelay = bytesInFlight * par.byteDelay.tv_nsec / 1000; // usec
-    par.bufSize = bytesInFlight + 1;
-    par.tx2rx = realloc(par.tx2rx, par.bufSize);
-    par.tx2rxValid = realloc(par.tx2rxValid, par.bufSize);
-    par.rx2tx = realloc(par.rx2tx, par.bufSize);
-    par.rx2txValid = realloc(par.rx2txValid, par.bufSize);
-    if (par.tx2rx == NULL || par.tx2rxValid == NULL || par.rx2tx == NULL || par.rx2txValid == NULL)
+    c->seed = seed;
+    // Different streams for the two directions
+    channelSeed(&c->tx2rx, seed * 2);
+    channelSeed(&c->rx2tx, seed * 2 + 1);
+    printf("SEED SET TO %llu\n", (unsigned long long) seed);
+}
+
+
+// Convert a bit error rate to the rate of bytes with at least one error
+double ber_to_byte_er(double ber)
+{
+    return 1.0 - pow(1 - ber, 8);
+}
+
+
+// Set the tick to the longer of TICK_NSEC and one byte time (10 bit times),
+// taking the fastest cable
+void update_tick(void)
+{
+    long tick = 0;
+    for (int i = 0; i < par.nCables; i++)
     {
-        return -1;
+        long byteDelay = (long) (1.0e10 / par.cables[i].channel.baudRate);
+        long cableTick = byteDelay > TICK_NSEC ? byteDelay : TICK_NSEC;
+        if (tick == 0 || cableTick < tick) tick = cableTick;
     }
-    bzero(par.tx2rxValid, par.bufSize);
-    bzero(par.rx2txValid, par.bufSize);
-    par.tx2rxIdx = 0;
-    par.rx2txIdx = 0;
-    printf("PROPAGATION DELAY SET TO %ld usec (DESIRED = %lu usec)\n", actualPropDelay, par.propDelay);
-    return 0;
+    pacerSetPeriod(&par.pacer, tick);
 }
 
 
 // Set the byte delay corresponding to the selected baud rate
-void set_baud_rate(unsigned long baud)
+void set_baud_rate(struct Cable *c, unsigned long baud)
 {
-    // 10 bit times per byte; delay in nanoseconds
-    double delay = 1.0e10 / baud;
-    par.byteDelay.tv_sec = 0;
-    par.byteDelay.tv_nsec = (long) delay;
+    c->channel.baudRate = baud;
+    apply_channel_config(c);
+    update_tick();
     printf("BAUD RATE: %lu\n", baud);
-    init_ring_buffers();
 }
 
 
@@ -144,84 +216,146 @@ void set_rt_priority(void) {
 }
 
 
-// Compute the difference between two timespecs
-struct timespec timespec_diff(const struct timespec *t2, const struct timespec *t1)
+long long now_ns(void)
 {
-    struct timespec diff = { .tv_sec = t2->tv_sec - t1->tv_sec,
-                             .tv_nsec = t2->tv_nsec - t1->tv_nsec };
-    if (diff.tv_nsec < 0) {
-        diff.tv_nsec += 1000000000;
-        --diff.tv_sec;
-    }
-    return diff;
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
 }
 
 
-// Compute the sum of two timespecs
-struct timespec timespec_sum(const struct timespec *t1, const struct timespec *t2)
+// Time on the cable clock, which runs ahead of the real one in virtual time
+long long cable_time(void)
 {
-    struct timespec sum = { .tv_sec = t1->tv_sec + t2->tv_sec,
-                             .tv_nsec = t1->tv_nsec + t2->tv_nsec };
-    if (sum.tv_nsec >= 1000000000) {
-        sum.tv_nsec -= 1000000000;
-        ++sum.tv_sec;
-    }
-    return sum;
+    return now_ns() + par.skipped;
 }
 
 
-// Compare two timespecs returning -1, 0 or 1 if t1 is less than, equal or
-// greater than t2, respectively
-int timespec_comp(const struct timespec *t1, const struct timespec *t2)
+// Earliest arrival of a byte in flight in any cable and direction, or -1
+long long next_arrival(void)
 {
-    if (t1->tv_sec < t2->tv_sec) {
-        return -1;
-    }
-    else if (t1->tv_sec > t2->tv_sec) {
-        return 1;
-    }
-    else if (t1->tv_nsec < t2->tv_nsec) {
-        return -1;
+    long long next = -1;
+    for (int i = 0; i < par.nCables; i++)
+    {
+        struct Cable *c = &par.cables[i];
+        long long t[4] = {channelNextArrival(&c->tx2rx), channelNextArrival(&c->rx2tx),
+                          faultsNextRelease(&c->faults[0]), faultsNextRelease(&c->faults[1])};
+        for (int j = 0; j < 4; j++)
+        {
+            if (t[j] >= 0 && (next < 0 || t[j] < next)) next = t[j];
+        }
     }
-    else if (t1->tv_nsec > t2->tv_nsec) {
-        return 1;
+    return next;
+}
+
+
+void endlog(struct Cable *c)
+{
+    if (c->logging)
+    {
+        traceClose(&c->trace);
+        c->logging = FALSE;
+        printf("%lld BATCHES LOGGED", c->trace.batches);
+        if (c->trace.lostTotal > 0)
+        {
+            printf(", %lld NOT RECORDED (DISK TOO SLOW)", c->trace.lostTotal);
+        }
+        printf("\n");
     }
-    return 0;
 }
 
 
-int timespec_is_negative(const struct timespec *t)
+void startlog(struct Cable *c, const char *filename)
 {
-    if (t->tv_sec < 0 || t->tv_nsec < 0)
+    endlog(c);
+    if (traceOpen(&c->trace, filename, cable_time(), c->channel.baudRate, par.virtualTime) == 0)
     {
-        return TRUE;
+        c->logging = TRUE;
+        c->logIdle = FALSE;
+        printf("LOGGING TO FILE %s (VIEW WITH bin/tracedump)\n", filename);
     }
-    return FALSE;
+    else
+    {
+        printf("ERROR OPENING FILE %s, NOT LOGGING\n", filename);
+    }
+}
+
+
+// Record an event with no bytes in the trace
+void log_event(struct Cable *c, TraceEvent event)
+{
+    static const unsigned char none[1];
+    const unsigned char *bytes[TRACE_STREAMS] = {none, none, none, none};
+    const unsigned char *flags[TRACE_STREAMS] = {NULL, NULL, NULL, NULL};
+    int count[TRACE_STREAMS] = {0};
+    traceBatch(&c->trace, cable_time(), event, bytes, flags, count);
 }
 
 
-void endlog(void)
+// Record the bytes of a tick in the trace; an idle tick is only recorded
+// when the line goes idle
+void log_batch(struct Cable *c, long long now, const unsigned char *bytes[TRACE_STREAMS],
+               const unsigned char *flags[TRACE_STREAMS], const int count[TRACE_STREAMS])
 {
-    if (par.logfile != NULL)
+    if (count[TraceTxIn] + count[TraceRxOut] + count[TraceRxIn] + count[TraceTxOut] == 0)
     {
-        fclose(par.logfile);
-        par.logfile = NULL;
+        if (c->logIdle == FALSE)
+        {
+            traceBatch(&c->trace, now, TraceIdle, bytes, flags, count);
+            c->logIdle = TRUE;
+        }
+        return;
     }
+    traceBatch(&c->trace, now, TraceBytes, bytes, flags, count);
+    c->logIdle = FALSE;
 }
 
 
-void startlog(const char *filename)
+// Read up to the number of bytes the channel accepts this tick. While the
+// sender keeps the line full (*backlog), the line time since it became free
+// counts too, so a late tick does not slow the line down: *start is set to
+// when the batch goes out, for channelSend.
+// Returns the number of bytes read (0 if none or on error).
+int read_batch(int fd, Channel *ch, unsigned char *buf, long long now, long long tick,
+               int *backlog, long long *start)
 {
-    endlog();
-    par.logfile = fopen(filename, "w");
-    if (par.logfile != NULL)
+    *start = *backlog && ch->lineFree < now ? ch->lineFree : now;
+    int room = channelRoom(ch, *start, now + tick - *start);
+    if (room > BUF_SIZE) room = BUF_SIZE;
+    if (room == 0) return 0;
+    int res = read(fd, buf, room);
+    if (res < 0) res = 0;
+    *backlog = res == room;
+    return res;
+}
+
+
+// Write bytes delivered to an endpoint. In real time, what does not fit in
+// the pty is lost; in virtual time the cable waits for the endpoint to read
+// (up to a second without progress), and the wait is not link time.
+void write_bytes(int fd, const unsigned char *buf, int n)
+{
+    if (!par.virtualTime)
     {
-        fprintf(par.logfile, "Tx->Rx | Rx->Tx\n");
-        printf("LOGGING TO FILE %s\n", filename);
+        write(fd, buf, n);
+        return;
     }
-    else
+    while (n > 0)
     {
-        printf("ERROR OPENING FILE %s, NOT LOGGING\n", filename);
+        int res = write(fd, buf, n);
+        if (res > 0)
+        {
+            buf += res;
+            n -= res;
+            continue;
+        }
+        if (res == -1 && errno != EAGAIN && errno != EINTR) return;
+
+        long long before = now_ns();
+        struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+        int ready = poll(&pfd, 1, 1000);
+        par.skipped -= now_ns() - before;
+        if (ready == 0) return;
     }
 }
 
@@ -229,21 +363,55 @@ void startlog(const char *filename)
 // Show help
 void help()
 {
-    printf("\n\n"
-           "Transmitter must open " TXDEV "\n"
-           "Receiver must open " RXDEV "\n"
-           "\n"
+    printf("\n\n");
+    if (par.nCables == 1)
+    {
+        printf("Transmitter must open %s\n"
+               "Receiver must open %s\n", par.cables[0].txDev, par.cables[0].rxDev);
+    }
+    for (int i = 0; par.nCables > 1 && i < par.nCables; i++)
+    {
+        printf("Cable %d: transmitter must open %s, receiver must open %s\n",
+               i, par.cables[i].txDev, par.cables[i].rxDev);
+    }
+    printf("\n"
            "The cable program is sensible to the following interactive commands:\n"
            "--- help         : show this help\n"
+           "--- cable <n>    : apply the following commands to cable n (default=0)\n"
            "--- on           : connect the cable and data is exchanged (default state)\n"
            "--- off          : disconnect the cable disabling data to be exchanged\n"
            "--- ber <ber>    : add noise to data bits at a specified BER (default=0)\n"
+           "--- burst <p_gb> <p_bg> <ber_good> <ber_bad>\n"
+           "                 : add burst noise (Gilbert-Elliott): each byte moves from\n"
+           "                   the good to the bad state with probability p_gb and back\n"
+           "                   with p_bg, and data bits get the BER of the current state\n"
+           "--- dropout <period> <length>\n"
+           "                 : cut the line for <length> msec every <period> msec\n"
+           "                   (0 0 to disable)\n"
+           "--- seed <n>     : restart the noise sequence from seed n (default=1);\n"
+           "                   the same seed gives the same errors\n"
            "--- baud <rate>  : set baud rate, between 1200 and 115200 (default=9600)\n"
            "                   note that 10 bits are sent per byte (8-N-1)\n"
            "--- prop <delay> : set the propagation delay in usec (0-1000000, default=0)\n"
-           "                   will be approximated to an integer multiple of the byte\n"
-           "                   delay (10 / baud_rate)\n"
-           "--- log <file>   : log transmitted data to file\n"
+           "--- fault <tx|rx> <type> <n> <action>\n"
+           "                 : act on the nth frame from now of a type (set, ua, disc, i,\n"
+           "                   rr, rej or any) sent by the transmitter (tx) or the\n"
+           "                   receiver (rx); action is drop, corrupt (BCC1), corrupt data\n"
+           "                   (I-frames), delay <msec> or dup\n"
+           "--- fault list   : show the faults still to come\n"
+           "--- fault clear  : remove the faults still to come\n"
+           "--- jitter       : show the histogram of pacing errors (how late each tick\n"
+           "                   woke up), which bounds the accuracy of the baud rate\n"
+           "--- jitter reset : clear the pacing error histogram\n"
+           "--- spin <usec>  : busy-poll the last <usec> before each tick instead of\n"
+           "                   sleeping, for more precise ticks (0-1000, default=0)\n"
+           "--- stats        : show the traffic of each cable since the first byte: bytes\n"
+           "                   per direction, line utilisation, bytes lost while off,\n"
+           "                   errors injected, bytes in flight and pacing lag\n"
+           "--- stats <sec>  : show the traffic of the last <sec> seconds every <sec>\n"
+           "                   seconds (0 to stop)\n"
+           "--- log <file>   : log transmitted data to a binary trace file\n"
+           "                   (convert to text with bin/tracedump <file>)\n"
            "--- endlog       : stop logging transmitted data\n"
            "--- quit         : terminate the program\n"
            "\n"
@@ -252,308 +420,842 @@ void help()
            "\n");
 }
 
-int main(int argc, char *argv[])
+// Read a scenario: one "<seconds> <command>" per line, in time order, where
+// seconds count from the first byte the cable carries and steps at 0 run at
+// startup. Blank lines and lines starting with # are skipped.
+// Returns 0 on success or -1 on error.
+int load_scenario(const char *filename)
 {
-    printf("\n");
-
-    system("socat -dd PTY,link=" TXDEV ",mode=777,raw,echo=0 PTY,link=" TX_EMULATOR ",mode=777,raw,echo=0 &");
-    sleep(1);
-    printf("\n");
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        perror(filename);
+        return -1;
+    }
 
-    system("socat -dd PTY,link=" RXDEV ",mode=777,raw,echo=0 PTY,link=" RX_EMULATOR ",mode=777,raw,echo=0 &");
-    sleep(1);
+    char line[CMD_SIZE + 32];
+    int lineNumber = 0;
+    double last = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        lineNumber++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *p = line + strspn(line, " \t");
+        if (*p == '\0' || *p == '#') continue;
+
+        double seconds;
+        int n;
+        if (sscanf(p, "%lf %n", &seconds, &n) < 1 || seconds < last || p[n] == '\0' ||
+            strlen(p + n) >= CMD_SIZE || scenario.nSteps == MAX_STEPS)
+        {
+            fprintf(stderr, "%s:%d: expected \"<seconds> <command>\" in time order "
+                            "(at most %d steps)\n", filename, lineNumber, MAX_STEPS);
+            fclose(file);
+            return -1;
+        }
+        last = seconds;
+        scenario.at[scenario.nSteps] = (long long) (seconds * 1e9);
+        strcpy(scenario.command[scenario.nSteps], p + n);
+        scenario.nSteps++;
+    }
+    fclose(file);
+    return 0;
+}
 
-    help();
 
-    // Configure serial ports
-    struct termios oldtioTx;
-    struct termios newtioTx;
+// Read the traffic counters of a cable at time now
+void get_counters(struct Cable *c, long long now, struct Counters *cnt)
+{
+    Channel *ch[2] = {&c->tx2rx, &c->rx2tx};
+    cnt->time = now;
+    for (int i = 0; i < 2; i++)
+    {
+        cnt->read[i] = c->bytesRead[i];
+        cnt->sent[i] = ch[i]->bytesSent;
+        cnt->delivered[i] = c->bytesWritten[i];
+        cnt->off[i] = c->bytesOff[i];
+        cnt->corrupted[i] = ch[i]->bytesCorrupted;
+        cnt->dropped[i] = ch[i]->bytesDropped;
+        cnt->faults[i] = c->faults[i].injected;
+    }
+}
 
-    int fdTx = openSerialPort(TX_EMULATOR, &oldtioTx, &newtioTx);
 
-    if (fdTx < 0)
+// Print the traffic of a cable between two readings of its counters
+void print_stats(struct Cable *c, const struct Counters *from, const struct Counters *to)
+{
+    Channel *ch[2] = {&c->tx2rx, &c->rx2tx};
+    const char *names[2] = {"TX->RX", "RX->TX"};
+    long long span = to->time - from->time;
+    printf("STATS CABLE %d OVER %.3f s (%ld BAUD, PROP %lld usec)\n", c->id, span / 1e9,
+           c->channel.baudRate, c->channel.delay / 1000);
+    for (int i = 0; i < 2; i++)
     {
-        perror("Opening Tx emulator serial port");
-        exit(-1);
+        // The line is busy one byte time for each byte put on it
+        long long sent = to->sent[i] - from->sent[i];
+        double utilisation = span > 0 ? 100.0 * sent * ch[i]->byteTime / span : 0;
+        printf("  %s: %lld read, %lld delivered, utilisation %.1f %%, %lld lost while off, "
+               "%lld corrupted, %lld dropped, %lld faults, %d in flight\n",
+               names[i], to->read[i] - from->read[i], to->delivered[i] - from->delivered[i],
+               utilisation, to->off[i] - from->off[i], to->corrupted[i] - from->corrupted[i],
+               to->dropped[i] - from->dropped[i], to->faults[i] - from->faults[i],
+               (int) (ch[i]->tail - ch[i]->head));
     }
+}
 
-    struct termios oldtioRx;
-    struct termios newtioRx;
 
-    int fdRx = openSerialPort(RX_EMULATOR, &oldtioRx, &newtioRx);
+// Print the pacing lag since the pacer had the given counters
+void print_pacing(long long wakeups, long long late, long long skips)
+{
+    if (par.virtualTime)
+    {
+        printf("  PACING: virtual time\n");
+        return;
+    }
+    // The counters restart with "jitter reset"
+    if (par.pacer.wakeups < wakeups) wakeups = late = skips = 0;
+    wakeups = par.pacer.wakeups - wakeups;
+    printf("  PACING: %lld ticks, lag mean %.1f usec, max %.1f usec since the last reset, "
+           "%lld ticks skipped\n", wakeups,
+           wakeups > 0 ? (par.pacer.totalLate - late) / 1000.0 / wakeups : 0.0,
+           par.pacer.maxLate / 1000.0, par.pacer.skipped - skips);
+}
+
 
-    if (fdRx < 0)
+// Print the traffic of every cable since the first byte
+void show_stats(long long now)
+{
+    struct Counters start, current;
+    memset(&start, 0, sizeof(start));
+    start.time = par.firstByte < 0 ? now : par.firstByte;
+    for (int i = 0; i < par.nCables; i++)
     {
-        perror("Opening Rx emulator serial port");
-        exit(-1);
+        get_counters(&par.cables[i], now, &current);
+        print_stats(&par.cables[i], &start, &current);
     }
+    print_pacing(0, 0, 0);
+}
 
-    // Configure stdin to receive commands to this program
-    int oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
 
-    char rxStdin[BUF_SIZE] = {0};
+// Print the traffic of every cable since the last report, when one is due.
+void periodic_stats(long long now)
+{
+    if (par.statsPeriod <= 0 || now < par.nextStats) return;
+    for (int i = 0; i < par.nCables; i++)
+    {
+        struct Cable *c = &par.cables[i];
+        struct Counters current;
+        get_counters(c, now, &current);
+        print_stats(c, &c->reported, &current);
+        c->reported = current;
+    }
+    print_pacing(par.reportedWakeups, par.reportedLate, par.reportedSkips);
+    par.reportedWakeups = par.pacer.wakeups;
+    par.reportedLate = par.pacer.totalLate;
+    par.reportedSkips = par.pacer.skipped;
+    par.nextStats += par.statsPeriod;
+    if (par.nextStats <= now) par.nextStats = now + par.statsPeriod;
+}
 
-    int STOP = FALSE;
 
-    set_baud_rate(DEFAULT_BAUDRATE);
+// Start or stop the periodic report
+void set_stats_period(double seconds, long long now)
+{
+    par.statsPeriod = (long long) (seconds * 1e9);
+    par.nextStats = now + par.statsPeriod;
+    for (int i = 0; i < par.nCables; i++)
+    {
+        get_counters(&par.cables[i], now, &par.cables[i].reported);
+    }
+    par.reportedWakeups = par.pacer.wakeups;
+    par.reportedLate = par.pacer.totalLate;
+    par.reportedSkips = par.pacer.skipped;
+}
 
-    set_rt_priority();
 
-    // For logging
-    char tx2rxTx[3], tx2rxRx[3], rx2txTx[3], rx2txRx[3];
-    int cableIdle = FALSE;
+// Set a fault from "<tx|rx> <type> <n> <action>", or list or clear them.
+// Returns 0 on success or -1 on error.
+int set_fault(struct Cable *c, const char *args)
+{
+    const char *dirNames[2] = {"TX->RX", "RX->TX"};
+    if (strcmp(args, "clear") == 0)
+    {
+        faultsClear(&c->faults[0]);
+        faultsClear(&c->faults[1]);
+        printf("FAULTS CLEARED\n");
+        return 0;
+    }
+    if (strcmp(args, "list") == 0)
+    {
+        for (int d = 0; d < 2; d++)
+        {
+            for (int i = 0; i < c->faults[d].nRules; i++)
+            {
+                FaultRule *r = &c->faults[d].rules[i];
+                printf("FAULT %s: %s %s FRAME IN %d\n", dirNames[d], faultsActionName(r->action),
+                       faultsFrameName(r->type), r->count);
+            }
+        }
+        return 0;
+    }
 
-    printf("\nCable ready\n\n");
+    char dir[8], type[8], action[8];
+    int n = 0, used = 0;
+    if (sscanf(args, "%7s %7s %d %7s%n", dir, type, &n, action, &used) < 4) return -1;
+    const char *arg = args + used + strspn(args + used, " ");
+    int d = strcmp(dir, "tx") == 0 ? 0 : strcmp(dir, "rx") == 0 ? 1 : -1;
+    int t = faultsFrameType(type);
+    FaultAction a;
+    double delay = 0;
+    if (strcmp(action, "drop") == 0 && *arg == '\0') a = FaultDrop;
+    else if (strcmp(action, "corrupt") == 0 && *arg == '\0') a = FaultCorruptHeader;
+    else if (strcmp(action, "corrupt") == 0 && strcmp(arg, "data") == 0 && t == FrameI) a = FaultCorruptData;
+    else if (strcmp(action, "delay") == 0 && sscanf(arg, "%lf", &delay) == 1 && delay > 0) a = FaultDelay;
+    else if (strcmp(action, "dup") == 0 && *arg == '\0') a = FaultDuplicate;
+    else return -1;
+    if (d < 0 || t < 0 || n < 1) return -1;
+
+    if (faultsAdd(&c->faults[d], t, n, a, (long long) (delay * 1e6)) == -1)
+    {
+        printf("TOO MANY FAULTS (AT MOST %d PER DIRECTION)\n", FAULT_MAX_RULES);
+    }
+    else
+    {
+        printf("FAULT %s: %s %s FRAME %d FROM NOW\n", dirNames[d], faultsActionName(a),
+               faultsFrameName(t), n);
+    }
+    return 0;
+}
 
-    // To compensate for deviations in byte transmission time
-    struct timespec currentTime, nextTxTime, timeDiff, nextWait;
-    int skipWait = FALSE;
-    int unreliableRate = FALSE;
-    clock_gettime(CLOCK_MONOTONIC, &nextTxTime);
 
-    while (STOP == FALSE)
+// Run one cable command.
+// Returns TRUE if the command asks the cable to quit.
+int run_command(const char *cmd)
+{
+    struct Cable *c = par.selected;
+    if (strncmp(cmd, "cable ", 6) == 0)
     {
-        // Check how much waiting time we should have (if any)
-        clock_gettime(CLOCK_MONOTONIC, &currentTime);
-        timeDiff = timespec_diff(&currentTime, &nextTxTime);
-        nextTxTime = timespec_sum(&nextTxTime, &par.byteDelay);
-        if (timeDiff.tv_sec >= 1)
+        int id = -1;
+        sscanf(cmd + 6, "%d", &id);
+        if (id >= 0 && id < par.nCables)
         {
-            if (unreliableRate == FALSE)
+            par.selected = &par.cables[id];
+            printf("CABLE %d SELECTED (%s - %s)\n", id, par.selected->txDev, par.selected->rxDev);
+        }
+        else
+        {
+            printf("NO CABLE %d (THERE ARE %d)\n", id, par.nCables);
+        }
+    }
+    else if (strcmp(cmd, "off") == 0)
+    {
+        printf("CONNECTION OFF\n");
+        if (c->cableOn && c->logging)
+        {
+            log_event(c, TraceCableOff);
+        }
+        c->cableOn = FALSE;
+    }
+    else if (strcmp(cmd, "on") == 0)
+    {
+        printf("CONNECTION ON\n");
+        c->cableOn = TRUE;
+    }
+    else if (strncmp(cmd, "ber ", 4) == 0)
+    {
+        double ber = -1;
+        sscanf(cmd + 4, "%lf", &ber);
+        if (ber >= 0.0 && ber < 1.0)
+        {
+            c->channel.model = ber > 0.0 ? ErrorBernoulli : ErrorNone;
+            c->channel.byteER = ber_to_byte_er(ber);
+            apply_channel_config(c);
+            printf("BER SET TO %lf\n", ber);
+            if (ber > 0.01)
             {
-                printf("UNRELIABLE RATE: Could not keep up, timeDiff exceeded 1s\n"
-                       "No further warnings will be issued\n");
-                unreliableRate = TRUE;
+                printf("   ACTUAL BER WILL BE LOWER THAN DEFINED FOR VALUES ABOVE 0.01\n");
             }
         }
-        nextWait = timespec_diff(&nextTxTime, &currentTime);
-        if (timespec_is_negative(&nextWait))
+        else
+        {
+            printf("BAD BER VALUE %lf (MUST BE 0 <= BER < 1.0)", ber);
+        }
+    }
+    else if (strncmp(cmd, "burst ", 6) == 0)
+    {
+        double pgb, pbg, berGood, berBad;
+        if (sscanf(cmd + 6, "%lf %lf %lf %lf", &pgb, &pbg, &berGood, &berBad) < 4 ||
+            pgb < 0.0 || pgb > 1.0 || pbg < 0.0 || pbg > 1.0 ||
+            berGood < 0.0 || berGood >= 1.0 || berBad < 0.0 || berBad >= 1.0)
         {
-            skipWait = TRUE;
+            printf("BAD BURST PARAMETERS (PROBABILITIES BETWEEN 0 AND 1, 0 <= BER < 1.0)\n");
         }
         else
         {
-            skipWait = FALSE;
+            c->channel.model = ErrorGilbertElliott;
+            c->channel.pGoodToBad = pgb;
+            c->channel.pBadToGood = pbg;
+            c->channel.goodER = ber_to_byte_er(berGood);
+            c->channel.badER = ber_to_byte_er(berBad);
+            apply_channel_config(c);
+            printf("BURST NOISE SET (P_GB=%lf, P_BG=%lf, BER GOOD=%lf, BER BAD=%lf)\n",
+                   pgb, pbg, berGood, berBad);
         }
+    }
+    else if (strncmp(cmd, "dropout ", 8) == 0)
+    {
+        unsigned long period, length;
+        if (sscanf(cmd + 8, "%lu %lu", &period, &length) < 2 || length > period)
+        {
+            printf("BAD DROPOUT PARAMETERS (LENGTH MUST NOT EXCEED PERIOD)\n");
+        }
+        else
+        {
+            c->channel.dropPeriod = period * 1000000LL;
+            c->channel.dropLength = length * 1000000LL;
+            apply_channel_config(c);
+            printf("DROPOUT SET TO %lu msec EVERY %lu msec\n", length, period);
+        }
+    }
+    else if (strncmp(cmd, "seed ", 5) == 0)
+    {
+        unsigned long long seed;
+        if (sscanf(cmd + 5, "%llu", &seed) < 1)
+        {
+            printf("BAD SEED\n");
+        }
+        else
+        {
+            seed_channels(c, seed);
+        }
+    }
+    else if (strncmp(cmd, "baud ", 5) == 0)
+    {
+        unsigned long baud = 0;
+        sscanf(cmd + 5, "%lu", &baud);
+        switch (baud) {
+            case 1200:
+            case 1800:
+            case 2400:
+            case 4800:
+            case 9600:
+            case 19200:
+            case 38400:
+            case 57600:
+            case 115200:
+                set_baud_rate(c, baud);
+                break;
+            default:
+                printf("UNSUPPORTED BAUD RATE: must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600 or 115200\n");
+        }
+    }
+    else if (strncmp(cmd, "prop ", 5) == 0)
+    {
+        unsigned long propDelay;
+        if (sscanf(cmd + 5, "%lu", &propDelay) < 1 || propDelay > 1000000)
+        {
+            printf("BAD OR OUT OF RANGE PROPAGATION DELAY\n");
+        }
+        else
+        {
+            c->channel.delay = propDelay * 1000LL;
+            apply_channel_config(c);
+            printf("PROPAGATION DELAY SET TO %lu usec\n", propDelay);
+        }
+    }
+    else if (strncmp(cmd, "fault ", 6) == 0)
+    {
+        if (set_fault(c, cmd + 6) == -1)
+        {
+            printf("BAD FAULT: fault <tx|rx> <type> <n> <action>\n");
+        }
+    }
+    else if (strcmp(cmd, "stats") == 0)
+    {
+        show_stats(cable_time());
+    }
+    else if (strncmp(cmd, "stats ", 6) == 0)
+    {
+        double seconds = -1;
+        sscanf(cmd + 6, "%lf", &seconds);
+        if (seconds < 0 || (seconds > 0 && seconds < 0.01))
+        {
+            printf("BAD STATS PERIOD (0 OR AT LEAST 0.01 s)\n");
+        }
+        else
+        {
+            set_stats_period(seconds, cable_time());
+            if (seconds > 0) printf("STATS EVERY %.3f s\n", seconds);
+            else printf("NO PERIODIC STATS\n");
+        }
+    }
+    else if (strncmp(cmd, "log ", 4) == 0)
+    {
+        startlog(c, cmd + 4);
+    }
+    else if (strcmp(cmd, "endlog") == 0)
+    {
+        endlog(c);
+        printf("NOT LOGGING\n");
+    }
+    else if (strcmp(cmd, "quit") == 0)
+    {
+        printf("END OF THE PROGRAM\n");
+        return TRUE;
+    }
+    else if (strcmp(cmd, "jitter") == 0)
+    {
+        pacerPrint(&par.pacer);
+    }
+    else if (strcmp(cmd, "jitter reset") == 0)
+    {
+        pacerReset(&par.pacer);
+        printf("PACING ERROR HISTOGRAM CLEARED\n");
+    }
+    else if (strncmp(cmd, "spin ", 5) == 0)
+    {
+        unsigned long spin;
+        if (sscanf(cmd + 5, "%lu", &spin) < 1 || spin > 1000)
+        {
+            printf("BAD OR OUT OF RANGE SPIN TIME\n");
+        }
+        else
+        {
+            par.pacer.spin = spin * 1000;
+            printf("SPIN SET TO %lu usec\n", spin);
+        }
+    }
+    else if (strcmp(cmd, "help") == 0) {
+        help();
+    }
+    else {
+        printf("BAD COMMAND OR MISSING PARAMETERS\n");
+    }
+    return FALSE;
+}
+
+// Start of the idle time that ends the scenario: the line may also have
+// been idle before the last step (e.g. with the cable off)
+long long idle_since(void)
+{
+    return par.lastActivity > scenario.end ? par.lastActivity : scenario.end;
+}
+
+
+// Run the scenario steps that are due.
+// Returns TRUE when the scenario is over and the cable should quit.
+int run_scenario(long long now)
+{
+    while (scenario.next < scenario.nSteps)
+    {
+        long long at = scenario.at[scenario.next];
+        if (at > 0 && (par.firstByte < 0 || now - par.firstByte < at)) break;
+        printf("SCENARIO %.3f s: %s\n", at / 1e9, scenario.command[scenario.next]);
+        if (run_command(scenario.command[scenario.next++])) return TRUE;
+        scenario.end = now;
+    }
+    if (scenario.next < scenario.nSteps) return FALSE;
+    if (scenario.idleQuit < 0) return TRUE;
+    return par.firstByte >= 0 && now - idle_since() >= scenario.idleQuit;
+}
+
+
+// Milliseconds until the scenario needs to run, or -1 if only traffic can
+// make it progress
+int scenario_timeout(long long now)
+{
+    long long due;
+    if (scenario.nSteps == 0 || par.firstByte < 0) return -1;
+    if (scenario.next < scenario.nSteps) due = par.firstByte + scenario.at[scenario.next];
+    else if (scenario.idleQuit >= 0) due = idle_since() + scenario.idleQuit;
+    else return -1;
+    return due <= now ? 0 : (int) ((due - now + 999999) / 1000000);
+}
+
 
-        // Read from Tx
-        int bytesFromTx = read(fdTx, par.tx2rx + par.tx2rxIdx, 1);
-        par.tx2rxValid[par.tx2rxIdx] = bytesFromTx > 0;
+// Print what went through the cable, as one JSON object
+void print_summary(struct Cable *c, long long now)
+{
+    Channel *ch[2] = {&c->tx2rx, &c->rx2tx};
+    const char *names[2] = {"tx2rx", "rx2tx"};
+    printf("SUMMARY {\"cable\": %d, \"seconds\": %.3f, \"virtual_time\": %s, \"baud_rate\": %ld, "
+           "\"seed\": %llu", c->id, par.firstByte < 0 ? 0.0 : (now - par.firstByte) / 1e9,
+           par.virtualTime ? "true" : "false", c->channel.baudRate, (unsigned long long) c->seed);
+    for (int i = 0; i < 2; i++)
+    {
+        printf(", \"%s\": {\"read\": %lld, \"delivered\": %lld, \"corrupted\": %lld, "
+               "\"dropped\": %lld, \"cable_off\": %lld, \"faults\": %lld}",
+               names[i], c->bytesRead[i], c->bytesWritten[i], ch[i]->bytesCorrupted,
+               ch[i]->bytesDropped, c->bytesOff[i], c->faults[i].injected);
+    }
+    printf("}\n");
+}
 
-        // Read from Rx
-        int bytesFromRx = read(fdRx, par.rx2tx + par.rx2txIdx, 1);
-        par.rx2txValid[par.rx2txIdx] = bytesFromRx > 0;
 
-        if (!par.cableOn)
+// Create the ports of cable id and its channels.
+// Returns 0 on success or -1 on error.
+int open_cable(struct Cable *c, int id)
+{
+    memset(c, 0, sizeof(*c));
+    c->id = id;
+    c->cableOn = TRUE;
+    if (id == 0)
+    {
+        strcpy(c->txDev, TXDEV);
+        strcpy(c->rxDev, RXDEV);
+        strcpy(c->txEmulator, TX_EMULATOR);
+        strcpy(c->rxEmulator, RX_EMULATOR);
+    }
+    else
+    {
+        snprintf(c->txDev, sizeof(c->txDev), "/dev/ttyS%d", DEV_NUMBER + 2 * id);
+        snprintf(c->rxDev, sizeof(c->rxDev), "/dev/ttyS%d", DEV_NUMBER + 2 * id + 1);
+        snprintf(c->txEmulator, sizeof(c->txEmulator), TX_EMULATOR "%d", id);
+        snprintf(c->rxEmulator, sizeof(c->rxEmulator), RX_EMULATOR "%d", id);
+    }
+
+    char command[256];
+    const char *devs[2][2] = {{c->txDev, c->txEmulator}, {c->rxDev, c->rxEmulator}};
+    for (int i = 0; i < 2; i++)
+    {
+        snprintf(command, sizeof(command), "socat -dd PTY,link=%s,mode=777,raw,echo=0 "
+                 "PTY,link=%s,mode=777,raw,echo=0 &", devs[i][0], devs[i][1]);
+        system(command);
+        sleep(1);
+        printf("\n");
+    }
+
+    // Configure serial ports
+    struct termios newtio;
+    c->fdTx = openSerialPort(c->txEmulator, &c->oldtioTx, &newtio);
+    if (c->fdTx < 0)
+    {
+        perror("Opening Tx emulator serial port");
+        return -1;
+    }
+    c->fdRx = openSerialPort(c->rxEmulator, &c->oldtioRx, &newtio);
+    if (c->fdRx < 0)
+    {
+        perror("Opening Rx emulator serial port");
+        return -1;
+    }
+
+    c->channel = channelDefaultConfig();
+    c->channel.baudRate = DEFAULT_BAUDRATE;
+    if (channelInit(&c->tx2rx, &c->channel, 0) == -1 || channelInit(&c->rx2tx, &c->channel, 0) == -1)
+    {
+        perror("Allocating channels");
+        return -1;
+    }
+    seed_channels(c, DEFAULT_SEED);
+    if (faultsInit(&c->faults[0]) == -1 || faultsInit(&c->faults[1]) == -1)
+    {
+        perror("Allocating fault injection");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Restore the ports of a cable and free its channels
+void close_cable(struct Cable *c)
+{
+    endlog(c);
+    if (tcsetattr(c->fdRx, TCSANOW, &c->oldtioRx) == -1 ||
+        tcsetattr(c->fdTx, TCSANOW, &c->oldtioTx) == -1)
+    {
+        perror("tcsetattr");
+    }
+    close(c->fdTx);
+    close(c->fdRx);
+    channelDestroy(&c->tx2rx);
+    channelDestroy(&c->rx2tx);
+    faultsDestroy(&c->faults[0]);
+    faultsDestroy(&c->faults[1]);
+}
+
+
+// Report the faults injected since the last call, with the time on the
+// scenario's clock
+void show_faults(struct Cable *c, long long now)
+{
+    const char *dirNames[2] = {"TX->RX", "RX->TX"};
+    for (int d = 0; d < 2; d++)
+    {
+        Faults *f = &c->faults[d];
+        if (f->injected == c->faultsShown[d]) continue;
+        c->faultsShown[d] = f->injected;
+        if (par.nCables > 1) printf("CABLE %d ", c->id);
+        printf("FAULT %s: %s %s FRAME %lld AT %.6f s\n", dirNames[d], faultsActionName(f->lastAction),
+               faultsFrameName(f->lastType), f->lastFrame,
+               par.firstByte < 0 ? 0.0 : (now - par.firstByte) / 1e9);
+    }
+}
+
+
+// Move one tick of traffic through a cable. Sets *busy if bytes were read
+// or are in flight, and *writing if an endpoint wrote bytes.
+void cable_tick(struct Cable *c, long long now, long long tick, int *busy, int *writing)
+{
+    static unsigned char inTx[BUF_SIZE], inRx[BUF_SIZE], outTx[BUF_SIZE], outRx[BUF_SIZE];
+    static unsigned char flags[TRACE_STREAMS][BUF_SIZE];
+    const unsigned char *traceBytes[TRACE_STREAMS] = {inTx, outRx, inRx, outTx};
+    const unsigned char *traceFlags[TRACE_STREAMS] = {flags[0], flags[1], flags[2], flags[3]};
+
+    // Read what the line can carry until the next tick; the channels keep
+    // each byte's own slot, so batching does not change the timing.
+    // What is read while the cable is off is ignored.
+    long long startTx, startRx;
+    int bytesFromTx = read_batch(c->fdTx, &c->tx2rx, inTx, now, tick, &c->backlog[0], &startTx);
+    int bytesFromRx = read_batch(c->fdRx, &c->rx2tx, inRx, now, tick, &c->backlog[1], &startRx);
+    if (c->cableOn)
+    {
+        // Noise, dropouts and delay are applied by the channels
+        channelSend(&c->tx2rx, inTx, bytesFromTx, startTx, flags[TraceTxIn]);
+        channelSend(&c->rx2tx, inRx, bytesFromRx, startRx, flags[TraceRxIn]);
+    }
+
+    // Bytes arriving while the cable is off are lost
+    int bytesToRx = channelReceive(&c->tx2rx, outRx, BUF_SIZE, now);
+    int bytesToTx = channelReceive(&c->rx2tx, outTx, BUF_SIZE, now);
+
+    // Targeted faults act on the frames as they leave the line
+    faultsPut(&c->faults[0], outRx, bytesToRx, now);
+    faultsPut(&c->faults[1], outTx, bytesToTx, now);
+    bytesToRx = faultsGet(&c->faults[0], outRx, BUF_SIZE, now);
+    bytesToTx = faultsGet(&c->faults[1], outTx, BUF_SIZE, now);
+    show_faults(c, now);
+
+    if (c->cableOn && bytesToRx > 0)
+    {
+        write_bytes(c->fdRx, outRx, bytesToRx);
+    }
+    if (c->cableOn && bytesToTx > 0)
+    {
+        write_bytes(c->fdTx, outTx, bytesToTx);
+    }
+
+    c->bytesRead[0] += bytesFromTx;
+    c->bytesRead[1] += bytesFromRx;
+    if (c->cableOn)
+    {
+        c->bytesWritten[0] += bytesToRx;
+        c->bytesWritten[1] += bytesToTx;
+    }
+    else
+    {
+        c->bytesOff[0] += bytesFromTx + bytesToRx;
+        c->bytesOff[1] += bytesFromRx + bytesToTx;
+    }
+    if (bytesFromTx > 0 || bytesFromRx > 0)
+    {
+        *writing = TRUE;
+    }
+    if (*writing || channelNextArrival(&c->tx2rx) >= 0 || channelNextArrival(&c->rx2tx) >= 0 ||
+        faultsNextRelease(&c->faults[0]) >= 0 || faultsNextRelease(&c->faults[1]) >= 0)
+    {
+        *busy = TRUE;
+    }
+
+    if (c->logging)
+    {
+        // The channels flagged the bytes they carried; flag the ones
+        // discarded by the cable being off
+        int cableFlag = c->cableOn ? 0 : TRACE_CABLE_OFF;
+        if (!c->cableOn)
         {
-            // Ignore what was read
-            par.tx2rxValid[par.tx2rxIdx] = 0;
-            par.rx2txValid[par.rx2txIdx] = 0;
+            memset(flags[TraceTxIn], cableFlag, bytesFromTx);
+            memset(flags[TraceRxIn], cableFlag, bytesFromRx);
         }
+        memset(flags[TraceRxOut], cableFlag, bytesToRx);
+        memset(flags[TraceTxOut], cableFlag, bytesToTx);
+        int count[TRACE_STREAMS] = {bytesFromTx, bytesToRx, bytesFromRx, bytesToTx};
+        log_batch(c, now, traceBytes, traceFlags, count);
+    }
+}
 
-        if (par.logfile != NULL)  // Currently logging
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:q:v")) != -1)
+    {
+        if (opt == 'v')
         {
-            if (par.tx2rxValid[par.tx2rxIdx])
-            {
-                sprintf(tx2rxTx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
-            }
-            else
-            {
-                memcpy(tx2rxTx, "  ", 3);
-            }
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                sprintf(rx2txTx, "%02hhX", par.rx2tx[par.rx2txIdx]);
-            }
-            else
-            {
-                memcpy(rx2txTx, "  ", 3);
-            }
+            par.virtualTime = TRUE;
+            continue;
+        }
+        if (opt == 'n' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_CABLES)
+        {
+            par.nCables = atoi(optarg);
+            continue;
+        }
+        if (opt == 's' && load_scenario(optarg) == 0) continue;
+        if (opt == 'q' && atof(optarg) >= 0)
+        {
+            scenario.idleQuit = (long long) (atof(optarg) * 1e9);
+            continue;
         }
+        fprintf(stderr, "Usage: %s [-n cables] [-s scenario] [-q seconds] [-v]\n"
+                        "  -n: number of cables, 1 to %d (cable i uses /dev/ttyS<10+2i> and\n"
+                        "      /dev/ttyS<11+2i>)\n"
+                        "  -s: run the timed commands of a scenario file, then quit\n"
+                        "  -q: after the scenario, wait until the line was idle this long\n"
+                        "  -v: virtual time: skip the time bytes only spend serializing and\n"
+                        "      propagating, and report link time on the cable's clock\n",
+                argv[0], MAX_CABLES);
+        exit(1);
+    }
 
-        // Advance indices to next position
-        par.tx2rxIdx = (par.tx2rxIdx + 1) % par.bufSize;
-        par.rx2txIdx = (par.rx2txIdx + 1) % par.bufSize;
+    printf("\n");
 
-        if (par.cableOn)
+    pacerInit(&par.pacer, TICK_NSEC, 0);
+    for (int i = 0; i < par.nCables; i++)
+    {
+        if (open_cable(&par.cables[i], i) == -1)
         {
-            if (par.tx2rxValid[par.tx2rxIdx])
-            {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
-                {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.tx2rx[par.tx2rxIdx] ^= (char) 1 << rand() % 8;
-                }
-                write(fdRx, par.tx2rx + par.tx2rxIdx, 1);
-            }
+            exit(-1);
+        }
+    }
+    par.selected = &par.cables[0];
+    update_tick();
 
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
-                {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.rx2tx[par.rx2txIdx] ^= (char) 1 << rand() % 8;
-                }
-                write(fdTx, par.rx2tx + par.rx2txIdx, 1);
-            }
+    help();
+
+    // Configure stdin to receive commands to this program
+    int oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
+    fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
+
+    // While the lines are idle, the cable sleeps until one of these has input
+    int epfd = epoll_create1(0);
+    int watched[2 * MAX_CABLES + 1];
+    int nWatched = 0;
+    for (int i = 0; i < par.nCables; i++)
+    {
+        watched[nWatched++] = par.cables[i].fdTx;
+        watched[nWatched++] = par.cables[i].fdRx;
+    }
+    watched[nWatched++] = STDIN_FILENO;
+    for (int i = 0; i < nWatched; i++)
+    {
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = watched[i]};
+        if (epfd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, watched[i], &ev) == 0)
+        {
+            continue;
+        }
+        // Commands from a regular file (or /dev/null) cannot be watched; they
+        // are all read on the first tick anyway
+        if (epfd >= 0 && errno == EPERM && watched[i] == STDIN_FILENO)
+        {
+            continue;
         }
+        perror("epoll");
+        exit(-1);
+    }
+
+    char rxStdin[BUF_SIZE] = {0};
+
+    int STOP = FALSE;
+
+    // Virtual time never sleeps while bytes are in flight, and at real-time
+    // priority it would starve the endpoints
+    if (!par.virtualTime)
+    {
+        set_rt_priority();
+    }
+
+    printf("\nCable ready%s\n\n", par.virtualTime ? " (VIRTUAL TIME)" : "");
+
+    int unreliableRate = FALSE;
+
+    while (STOP == FALSE)
+    {
+        long long now = cable_time();
+        long long tick = par.pacer.period;
 
-        if (par.logfile != NULL)  // Currently logging
+        int lineBusy = FALSE;
+        int writing = FALSE;
+        for (int i = 0; i < par.nCables; i++)
         {
-            if (par.tx2rxValid[par.tx2rxIdx])
-            {
-                sprintf(tx2rxRx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
-            }
-            else
-            {
-                memcpy(tx2rxRx, "  ", 3);
-            }
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                sprintf(rx2txRx, "%02hhX", par.rx2tx[par.rx2txIdx]);
-            }
-            else
-            {
-                memcpy(rx2txRx, "  ", 3);
-            }
+            cable_tick(&par.cables[i], now, tick, &lineBusy, &writing);
+        }
+        if (lineBusy)
+        {
+            if (par.firstByte < 0) par.firstByte = now;
+            par.lastActivity = now;
+        }
 
-            if (*tx2rxTx == ' ' && *rx2txTx == ' ' && *tx2rxRx == ' ' && *rx2txRx == ' ')
-            {
-                if (cableIdle == FALSE)
-                {
-                    fputs("---------------\n", par.logfile);
-                    cableIdle = TRUE;
-                }
-            }
-            else
+        // Read commands from STDIN to control the cable mode
+        int fromStdin = read(STDIN_FILENO, rxStdin, BUF_SIZE - 1);
+        if (fromStdin == 0)
+        {
+            // End of input: stop waking up for it
+            epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+        }
+        else if (fromStdin > 0)
+        {
+            rxStdin[fromStdin] = '\0';
+            for (char *cmd = strtok(rxStdin, "\n"); cmd != NULL; cmd = strtok(NULL, "\n"))
             {
-                fprintf(par.logfile, "%s  %s | %s  %s\n", tx2rxTx, tx2rxRx, rx2txTx, rx2txRx);
-                cableIdle = FALSE;
+                if (run_command(cmd)) STOP = TRUE;
             }
         }
 
-        // Read commands from STDIN to control the cable mode
-        int fromStdin = read(STDIN_FILENO, rxStdin, BUF_SIZE);
-        if (fromStdin > 0)
+        if (scenario.nSteps > 0 && run_scenario(now))
         {
-            rxStdin[fromStdin - 1] = '\0';
+            printf("END OF THE SCENARIO\n");
+            STOP = TRUE;
+        }
 
-            if (strcmp(rxStdin, "off") == 0)
-            {
-                printf("CONNECTION OFF\n");
-                if (par.cableOn && par.logfile != NULL)
-                {
-                    fputs("CABLE OFF\n", par.logfile);
-                }
-                par.cableOn = FALSE;
-            }
-            else if (strcmp(rxStdin, "on") == 0)
-            {
-                printf("CONNECTION ON\n");
-                par.cableOn = TRUE;
-            }
-            else if (strncmp(rxStdin, "ber ", 4) == 0)
-            {
-                double ber;
-                sscanf(rxStdin + 4, "%lf", &ber);
-                // Compute pow(1 - ber, 8) without libm
-                double acc = 1 - ber;
-                acc *= acc;   // Squared
-                acc *= acc;   // To the fourth
-                acc *= acc;   // To the eighth
-                par.byteER = 1.0 - acc;
-                //printf("Byte Error Rate is %lf\n", par.byteER);
-                if (ber >= 0.0 && ber < 1.0)
-                {
-                    printf("BER SET TO %lf\n", ber);
-                    if (ber > 0.01)
-                    {
-                        printf("   ACTUAL BER WILL BE LOWER THAN DEFINED FOR VALUES ABOVE 0.01\n");
-                    }
-                }
-                else
-                {
-                    printf("BAD BER VALUE %lf (MUST BE 0 <= BER < 1.0)", ber);
-                }
-            }
-            else if (strncmp(rxStdin, "baud ", 5) == 0)
-            {
-                unsigned long baud = 0;
-                sscanf(rxStdin + 5, "%lu", &baud);
-                switch (baud) {
-                    case 1200:
-                    case 1800:
-                    case 2400:
-                    case 4800:
-                    case 9600:
-                    case 19200:
-                    case 38400:
-                    case 57600:
-                    case 115200:
-                        set_baud_rate(baud);
-                        break;
-                    default:
-                        printf("UNSUPPORTED BAUD RATE: must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600 or 115200\n");
-                }
-            }
-            else if (strncmp(rxStdin, "prop ", 5) == 0)
-            {
-                unsigned long propDelay;
-                if (sscanf(rxStdin + 5, "%lu", &propDelay) < 1 || propDelay > 1000000)
-                {
-                    printf("BAD OR OUT OF RANGE PROPAGATION DELAY\n");
-                }
-                else
-                {
-                    par.propDelay = propDelay;
-                    init_ring_buffers();
-                }
-            }
-            else if (strncmp(rxStdin, "log ", 4) == 0)
-            {
-                startlog(rxStdin + 4);
-            }
-            else if (strcmp(rxStdin, "endlog") == 0)
-            {
-                endlog();
-                printf("NOT LOGGING\n");
-            }
-            else if (strcmp(rxStdin, "quit") == 0)
+        periodic_stats(now);
+
+        if (STOP)
+        {
+            break;
+        }
+        else if (!lineBusy && fromStdin <= 0)
+        {
+            // Nothing read and nothing in flight: block instead of ticking,
+            // unless a scenario step or a report comes first
+            int timeout = scenario_timeout(now);
+            if (par.statsPeriod > 0)
             {
-                printf("END OF THE PROGRAM\n");
-                STOP = TRUE;
-            }
-            else if (strcmp(rxStdin, "help") == 0) {
-                help();
-            }
-            else {
-                printf("BAD COMMAND OR MISSING PARAMETERS\n");
+                int statsTimeout = par.nextStats <= now ? 0 : (int) ((par.nextStats - now + 999999) / 1000000);
+                if (timeout < 0 || statsTimeout < timeout) timeout = statsTimeout;
             }
+            struct epoll_event events[2 * MAX_CABLES + 1];
+            while (epoll_wait(epfd, events, nWatched, timeout) == -1 && errno == EINTR);
+            pacerResume(&par.pacer);
         }
-
-        if (skipWait == FALSE) {
-            nanosleep(&nextWait, NULL);
+        else if (par.virtualTime)
+        {
+            // Move the clock instead of sleeping: by a tick while the
+            // endpoints are writing, otherwise to the next byte arriving.
+            // Idle time (e.g. the endpoints' timeouts) still passes at the
+            // real rate
+            long long next = now + tick;
+            if (!writing && next_arrival() > next) next = next_arrival();
+            long long current = cable_time();
+            if (next > current) par.skipped += next - current;
+        }
+        // Sleep until the next tick's absolute deadline
+        else if (pacerWait(&par.pacer) >= 1000000000L && unreliableRate == FALSE)
+        {
+            printf("UNRELIABLE RATE: Could not keep up, a tick was more than 1s late\n"
+                   "No further warnings will be issued (see the jitter command)\n");
+            unreliableRate = TRUE;
         }
     }
 
-    // Restore the old port settings
-    if (tcsetattr(fdRx, TCSANOW, &oldtioRx) == -1)
+    for (int i = 0; i < par.nCables; i++)
     {
-        perror("tcsetattr");
-        exit(-1);
+        print_summary(&par.cables[i], cable_time());
     }
-
-    if (tcsetattr(fdTx, TCSANOW, &oldtioTx) == -1)
+    for (int i = 0; i < par.nCables; i++)
     {
-        perror("tcsetattr");
-        exit(-1);
+        close_cable(&par.cables[i]);
     }
-
-    close(fdTx);
-    close(fdRx);
+    close(epfd);
 
     system("killall socat");
 
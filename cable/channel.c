@@ -0,0 +1,197 @@
+// Channel model implementation
+
+#include "channel.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHANNEL_CAPACITY 65536 // Bytes in flight, at most (power of two)
+
+ChannelConfig channelDefaultConfig()
+{
+    ChannelConfig config;
+    memset(&config, 0, sizeof(config));
+    config.baudRate = 9600;
+    config.model = ErrorNone;
+    return config;
+}
+
+// splitmix64, only used to expand a seed into the xoshiro state: its
+// outputs are well mixed even for adjacent seeds
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// xoshiro256**
+static uint64_t nextRandom(uint64_t s[4])
+{
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+double channelRandom(Channel *ch)
+{
+    return (nextRandom(ch->rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Number of clean bytes before the next event of per-byte probability p.
+static long long geometric(Channel *ch, double p)
+{
+    if (p <= 0) return LLONG_MAX;
+    if (p >= 1) return 0;
+    // 1 - u is in (0, 1], so the logarithm is finite
+    double n = floor(log(1.0 - channelRandom(ch)) / log1p(-p));
+    return n < (double) LLONG_MAX ? (long long) n : LLONG_MAX;
+}
+
+static double currentER(const Channel *ch)
+{
+    const ChannelConfig *c = &ch->config;
+    if (c->model == ErrorBernoulli) return c->byteER;
+    if (c->model == ErrorGilbertElliott) return ch->bad ? c->badER : c->goodER;
+    return 0;
+}
+
+// Draw new countdowns, after the rates or the generator changed.
+static void resample(Channel *ch)
+{
+    const ChannelConfig *c = &ch->config;
+    ch->toError = geometric(ch, currentER(ch));
+    ch->toSwitch = c->model == ErrorGilbertElliott ?
+                   geometric(ch, ch->bad ? c->pBadToGood : c->pGoodToBad) : LLONG_MAX;
+}
+
+int channelInit(Channel *ch, const ChannelConfig *config, uint64_t seed)
+{
+    memset(ch, 0, sizeof(*ch));
+    ch->capacity = CHANNEL_CAPACITY;
+    ch->bytes = malloc(ch->capacity);
+    ch->arrival = malloc(ch->capacity * sizeof(long long));
+    if (ch->bytes == NULL || ch->arrival == NULL) {
+        channelDestroy(ch);
+        return -1;
+    }
+    channelSetConfig(ch, config);
+    channelSeed(ch, seed);
+    return 0;
+}
+
+void channelSetConfig(Channel *ch, const ChannelConfig *config)
+{
+    ch->config = *config;
+    // 10 bit times per byte
+    ch->byteTime = config->baudRate > 0 ? 10000000000LL / config->baudRate : 0;
+    if (config->model != ErrorGilbertElliott) ch->bad = 0;
+    resample(ch);
+}
+
+void channelSeed(Channel *ch, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) ch->rng[i] = splitmix64(&seed);
+    ch->bad = 0;
+    resample(ch);
+}
+
+int channelRoom(Channel *ch, long long now, long long horizon)
+{
+    int room = ch->capacity - (int) (ch->tail - ch->head);
+    if (ch->byteTime == 0) return room;
+
+    long long start = ch->lineFree > now ? ch->lineFree : now;
+    long long n = (now + horizon - start + ch->byteTime - 1) / ch->byteTime;
+    if (n < 0) n = 0;
+    return n < room ? (int) n : room;
+}
+
+// Decide whether the byte sent at time start is corrupted or lost.
+// Return the byte as received, or -1 if it is lost.
+static int impair(Channel *ch, unsigned char byte, long long start)
+{
+    const ChannelConfig *c = &ch->config;
+    if (c->dropPeriod > 0 && start % c->dropPeriod >= c->dropPeriod - c->dropLength)
+        return -1;
+
+    // Errors are drawn as gaps rather than per byte, so a clean byte only
+    // costs two countdowns
+    int result = byte;
+    if (ch->toError-- == 0) {
+        // At most one wrong bit per byte, as in the original cable
+        ch->bytesCorrupted++;
+        result = byte ^ (1 << (nextRandom(ch->rng) % 8));
+        ch->toError = geometric(ch, currentER(ch));
+    }
+    if (ch->toSwitch-- == 0) {
+        // Gilbert-Elliott transition after this byte
+        ch->bad = !ch->bad;
+        ch->toSwitch = geometric(ch, ch->bad ? c->pBadToGood : c->pGoodToBad);
+        ch->toError = geometric(ch, currentER(ch));
+    }
+    return result;
+}
+
+void channelSend(Channel *ch, const unsigned char *buf, int n, long long now, unsigned char *fate)
+{
+    if (ch->lineFree < now) ch->lineFree = now;
+
+    for (int i = 0; i < n; i++) {
+        long long start = ch->lineFree;
+        ch->lineFree += ch->byteTime;
+        ch->bytesSent++;
+
+        int byte = impair(ch, buf[i], start);
+        if (byte < 0 || (int) (ch->tail - ch->head) == ch->capacity) {
+            ch->bytesDropped++;
+            if (fate != NULL) fate[i] = CHANNEL_DROPPED;
+            continue;
+        }
+        if (fate != NULL) fate[i] = byte != buf[i] ? CHANNEL_CORRUPTED : 0;
+        unsigned slot = ch->tail++ & (ch->capacity - 1);
+        ch->bytes[slot] = (unsigned char) byte;
+        ch->arrival[slot] = ch->lineFree + ch->config.delay;
+    }
+}
+
+int channelReceive(Channel *ch, unsigned char *buf, int max, long long now)
+{
+    int n = 0;
+    while (n < max && ch->head != ch->tail) {
+        unsigned slot = ch->head & (ch->capacity - 1);
+        if (ch->arrival[slot] > now) break;
+        buf[n++] = ch->bytes[slot];
+        ch->head++;
+    }
+    ch->bytesDelivered += n;
+    return n;
+}
+
+long long channelNextArrival(Channel *ch)
+{
+    if (ch->head == ch->tail) return -1;
+    return ch->arrival[ch->head & (ch->capacity - 1)];
+}
+
+void channelDestroy(Channel *ch)
+{
+    free(ch->bytes);
+    free(ch->arrival);
+    ch->bytes = NULL;
+    ch->arrival = NULL;
+}
@@ -0,0 +1,96 @@
+// Channel model header.
+// One direction of a serial line: bytes are serialized at the baud rate,
+// impaired by a seeded error model and periodic dropouts, and delivered after
+// a fixed propagation delay. The same seed and input give the same output,
+// so runs can be repeated exactly. Times are in nanoseconds, on any clock the
+// caller chooses.
+
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include <stdint.h>
+
+// Fate of a byte put on the line (see channelSend)
+#define CHANNEL_CORRUPTED 0x01
+#define CHANNEL_DROPPED   0x02
+
+typedef enum
+{
+    ErrorNone,
+    ErrorBernoulli,        // Independent errors at byteER
+    ErrorGilbertElliott,   // Two-state burst model
+} ErrorModel;
+
+typedef struct
+{
+    long baudRate;         // 10 bit times per byte (8-N-1)
+    ErrorModel model;
+    double byteER;         // Bernoulli: probability of corrupting a byte
+    double goodER;         // Gilbert-Elliott: byte error rate in the good state
+    double badER;          // Gilbert-Elliott: byte error rate in the bad state
+    double pGoodToBad;     // Gilbert-Elliott: per-byte transition probabilities
+    double pBadToGood;
+    long long dropPeriod;  // Every dropPeriod ns the line is cut...
+    long long dropLength;  // ...for dropLength ns (0 = never)
+    long long delay;       // Propagation delay in ns
+} ChannelConfig;
+
+typedef struct
+{
+    ChannelConfig config;
+    long long byteTime;    // ns per byte
+    uint64_t rng[4];       // xoshiro256** state
+    int bad;               // Gilbert-Elliott state
+    // Clean bytes left before the next error and before the next
+    // Gilbert-Elliott state change (drawn from geometric distributions)
+    long long toError;
+    long long toSwitch;
+    long long lineFree;    // When the last accepted byte finishes serializing
+    // Bytes in flight, with the time each one arrives
+    unsigned char *bytes;
+    long long *arrival;
+    int capacity;
+    unsigned head;
+    unsigned tail;
+    // Statistics
+    long long bytesSent;
+    long long bytesDelivered;
+    long long bytesCorrupted;
+    long long bytesDropped;
+} Channel;
+
+// Default configuration: 9600 baud, no errors, no delay.
+ChannelConfig channelDefaultConfig();
+
+// Initialize a channel; seed selects the sequence of errors.
+// Return 0 on success or -1 on error.
+int channelInit(Channel *ch, const ChannelConfig *config, uint64_t seed);
+
+// Change the configuration, keeping the bytes in flight.
+void channelSetConfig(Channel *ch, const ChannelConfig *config);
+
+// Restart the error sequence from seed.
+void channelSeed(Channel *ch, uint64_t seed);
+
+// Number of bytes the line can accept now whose transmission would start
+// before now + horizon.
+int channelRoom(Channel *ch, long long now, long long horizon);
+
+// Put n bytes on the line at time now (call channelRoom first to keep the
+// line rate). Errors and dropouts are decided here; if fate is not NULL,
+// fate[i] gets the CHANNEL_* flags of buf[i].
+void channelSend(Channel *ch, const unsigned char *buf, int n, long long now, unsigned char *fate);
+
+// Take up to max bytes that have arrived by time now.
+// Return the number of bytes stored in buf.
+int channelReceive(Channel *ch, unsigned char *buf, int max, long long now);
+
+// Return the arrival time of the next byte in flight, or -1 if there is none.
+long long channelNextArrival(Channel *ch);
+
+// Uniform random number in [0, 1) from the channel's generator.
+double channelRandom(Channel *ch);
+
+void channelDestroy(Channel *ch);
+
+#endif // _CHANNEL_H_
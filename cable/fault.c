@@ -0,0 +1,195 @@
+// Frame fault injection implementation
+
+#include "fault.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define FAULT_CAPACITY 65536 // Bytes held, at most (power of two)
+
+static const char *frameNames[FRAME_TYPES] = {"ANY", "SET", "UA", "DISC", "I", "RR", "REJ", "OTHER"};
+static const char *actionNames[] = {"DROP", "CORRUPT", "CORRUPT DATA", "DELAY", "DUP"};
+
+int faultsInit(Faults *f)
+{
+    memset(f, 0, sizeof(*f));
+    f->active = -1;
+    f->capacity = FAULT_CAPACITY;
+    f->bytes = malloc(f->capacity);
+    f->release = malloc(f->capacity * sizeof(long long));
+    if (f->bytes == NULL || f->release == NULL) {
+        faultsDestroy(f);
+        return -1;
+    }
+    return 0;
+}
+
+int faultsAdd(Faults *f, FrameType type, int n, FaultAction action, long long delay)
+{
+    if (f->nRules == FAULT_MAX_RULES || n < 1) return -1;
+    FaultRule *r = &f->rules[f->nRules++];
+    r->type = type;
+    r->count = n;
+    r->action = action;
+    r->delay = delay;
+    return 0;
+}
+
+void faultsClear(Faults *f)
+{
+    f->nRules = 0;
+}
+
+static FrameType classify(unsigned char control)
+{
+    switch (control) {
+        case C_SET: return FrameSET;
+        case C_UA: return FrameUA;
+        case C_DISC: return FrameDISC;
+        case C_I_0:
+        case C_I_1: return FrameI;
+        case C_RR_0:
+        case C_RR_1: return FrameRR;
+        case C_REJ_0:
+        case C_REJ_1: return FrameREJ;
+        default: return FrameOther;
+    }
+}
+
+// One bit of byte flipped, never into a FLAG or ESC that would move the
+// frame boundaries
+static unsigned char flip(unsigned char byte)
+{
+    unsigned char flipped = byte ^ 0x01;
+    return flipped == FLAG || flipped == ESC ? byte ^ 0x80 : flipped;
+}
+
+// Count a frame of type and fire the rules it completes.
+// Return the action of the first one, or -1.
+static int match(Faults *f, FrameType type, long long now)
+{
+    f->frames[FrameAny]++;
+    f->frames[type]++;
+    int action = -1;
+    for (int i = 0; i < f->nRules; i++) {
+        FaultRule *r = &f->rules[i];
+        if ((r->type != FrameAny && r->type != type) || --r->count > 0) continue;
+
+        if (action < 0) {
+            action = r->action;
+            f->injected++;
+            f->lastType = type;
+            f->lastAction = r->action;
+            f->lastFrame = f->frames[type];
+            if (r->action == FaultDelay && now + r->delay > f->releaseFloor)
+                f->releaseFloor = now + r->delay;
+        }
+        // Each rule fires once; the rules keep their order
+        memmove(r, r + 1, (f->nRules - i - 1) * sizeof(*r));
+        f->nRules--;
+        i--;
+    }
+    return action;
+}
+
+static void push(Faults *f, unsigned char byte, long long now)
+{
+    if ((int) (f->tail - f->head) == f->capacity) return;
+    unsigned slot = f->tail++ & (f->capacity - 1);
+    f->bytes[slot] = byte;
+    f->release[slot] = now > f->releaseFloor ? now : f->releaseFloor;
+}
+
+void faultsPut(Faults *f, const unsigned char *buf, int n, long long now)
+{
+    for (int i = 0; i < n; i++) {
+        unsigned char byte = buf[i];
+        if (f->frameLen < FAULT_MAX_FRAME) f->frame[f->frameLen] = byte;
+        f->frameLen++;
+
+        if (byte == FLAG) {
+            int active = f->pos > 0 ? f->active : -1;
+            if (active != FaultDrop) push(f, FLAG, now);
+            if (active == FaultDuplicate && f->frameLen <= FAULT_MAX_FRAME) {
+                for (int j = 0; j < f->frameLen; j++) push(f, f->frame[j], now);
+            }
+            // A FLAG both closes a frame and may open the next one
+            f->inFrame = 1;
+            f->escaped = 0;
+            f->pos = 0;
+            f->active = -1;
+            f->frame[0] = FLAG;
+            f->frameLen = 1;
+            continue;
+        }
+        if (!f->inFrame) {
+            push(f, byte, now);
+            continue;
+        }
+
+        // The control field decides the action, which applies from there on
+        int value = byte;
+        if (f->escaped) {
+            f->escaped = 0;
+            value = byte == ESC_FLAG ? FLAG : byte == ESC_ESC ? ESC : byte;
+        }
+        else if (byte == ESC) {
+            f->escaped = 1;
+            value = -1;
+        }
+        if (value >= 0) {
+            if (f->pos == 1) f->active = match(f, classify(value), now);
+            if ((f->active == FaultCorruptHeader && f->pos == 2) ||
+                (f->active == FaultCorruptData && f->pos == 3))
+                byte = flip(byte);
+            f->pos++;
+        }
+        if (f->active != FaultDrop) push(f, byte, now);
+    }
+}
+
+int faultsGet(Faults *f, unsigned char *buf, int max, long long now)
+{
+    int n = 0;
+    while (n < max && f->head != f->tail) {
+        unsigned slot = f->head & (f->capacity - 1);
+        if (f->release[slot] > now) break;
+        buf[n++] = f->bytes[slot];
+        f->head++;
+    }
+    return n;
+}
+
+long long faultsNextRelease(Faults *f)
+{
+    if (f->head == f->tail) return -1;
+    return f->release[f->head & (f->capacity - 1)];
+}
+
+int faultsFrameType(const char *name)
+{
+    for (int i = 0; i < FrameOther; i++) {
+        if (strcasecmp(name, frameNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+const char *faultsFrameName(FrameType type)
+{
+    return frameNames[type];
+}
+
+const char *faultsActionName(FaultAction action)
+{
+    return actionNames[action];
+}
+
+void faultsDestroy(Faults *f)
+{
+    free(f->bytes);
+    free(f->release);
+    f->bytes = NULL;
+    f->release = NULL;
+}
@@ -0,0 +1,102 @@
+// Frame fault injection header.
+// Targets single link layer frames instead of random bytes: a rule drops,
+// corrupts, delays or duplicates the Nth frame of a type that goes through
+// one direction of the cable, so each recovery path of the protocol can be
+// exercised on purpose. Frames are recognized by their control field (see
+// src/utils.h) as the bytes leave the cable. The action starts at that
+// field: the FLAG and address before it are always delivered.
+
+#ifndef _FAULT_H_
+#define _FAULT_H_
+
+#define FAULT_MAX_RULES 16
+#define FAULT_MAX_FRAME 4096   // Longer frames are not duplicated
+
+typedef enum
+{
+    FrameAny,
+    FrameSET,
+    FrameUA,
+    FrameDISC,
+    FrameI,
+    FrameRR,
+    FrameREJ,
+    FrameOther,            // Unknown control field
+    FRAME_TYPES
+} FrameType;
+
+typedef enum
+{
+    FaultDrop,             // The rest of the frame is lost
+    FaultCorruptHeader,    // One bit of BCC1 flipped
+    FaultCorruptData,      // One bit of the first data byte flipped (I-frames)
+    FaultDelay,            // The rest of the frame, and what follows, held back
+    FaultDuplicate,        // The frame delivered twice
+} FaultAction;
+
+typedef struct
+{
+    FrameType type;
+    int count;             // Frames of the type to let through, plus one
+    FaultAction action;
+    long long delay;       // FaultDelay: ns
+} FaultRule;
+
+typedef struct
+{
+    FaultRule rules[FAULT_MAX_RULES];
+    int nRules;
+    // Deframer
+    int inFrame;
+    int escaped;
+    int pos;               // Destuffed bytes of the current frame
+    unsigned char address;
+    int active;            // Action on the current frame, or -1
+    unsigned char frame[FAULT_MAX_FRAME];  // The current frame, as received
+    int frameLen;
+    // Bytes to deliver, with the time each one is released
+    unsigned char *bytes;
+    long long *release;
+    int capacity;
+    unsigned head;
+    unsigned tail;
+    long long releaseFloor; // Bytes leave in order, none before this
+    // Statistics
+    long long frames[FRAME_TYPES];  // Frames seen of each type (FrameAny: all)
+    long long injected;
+    FrameType lastType;    // The last frame a rule hit
+    FaultAction lastAction;
+    long long lastFrame;   // Its number among the frames of its type
+} Faults;
+
+// Initialize with no rules.
+// Return 0 on success or -1 on error.
+int faultsInit(Faults *f);
+
+// Act on the nth frame of type from now on (1 = the next one).
+// Return 0 on success or -1 if there are too many rules.
+int faultsAdd(Faults *f, FrameType type, int n, FaultAction action, long long delay);
+
+// Remove all rules that did not fire yet.
+void faultsClear(Faults *f);
+
+// Pass n bytes leaving the cable at time now through the rules.
+void faultsPut(Faults *f, const unsigned char *buf, int n, long long now);
+
+// Take up to max bytes released by time now.
+// Return the number of bytes stored in buf.
+int faultsGet(Faults *f, unsigned char *buf, int max, long long now);
+
+// Return the release time of the next byte held, or -1 if there is none.
+long long faultsNextRelease(Faults *f);
+
+// Frame type of a command name ("i", "rr", "any", ...), or -1.
+int faultsFrameType(const char *name);
+
+const char *faultsFrameName(FrameType type);
+
+const char *faultsActionName(FaultAction action);
+
+void faultsDestroy(Faults *f);
+
+#endif // _FAULT_H_
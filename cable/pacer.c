@@ -0,0 +1,119 @@
+// Tick pacing implementation
+
+#include "pacer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NSEC_PER_SEC 1000000000LL
+#define BAR_WIDTH 40
+
+static long long toNs(const struct timespec *t)
+{
+    return t->tv_sec * NSEC_PER_SEC + t->tv_nsec;
+}
+
+static struct timespec fromNs(long long ns)
+{
+    struct timespec t = {ns / NSEC_PER_SEC, ns % NSEC_PER_SEC};
+    return t;
+}
+
+static long long nowNs()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return toNs(&t);
+}
+
+void pacerInit(Pacer *p, long period, long spin)
+{
+    memset(p, 0, sizeof(*p));
+    p->period = period;
+    p->spin = spin;
+    p->deadline = fromNs(nowNs() + period);
+}
+
+void pacerSetPeriod(Pacer *p, long period)
+{
+    p->period = period;
+    pacerResume(p);
+}
+
+void pacerResume(Pacer *p)
+{
+    p->deadline = fromNs(nowNs() + p->period);
+}
+
+void pacerReset(Pacer *p)
+{
+    memset(p->histogram, 0, sizeof(p->histogram));
+    p->wakeups = 0;
+    p->totalLate = 0;
+    p->maxLate = 0;
+    p->skipped = 0;
+}
+
+static int bucket(long long late)
+{
+    long long us = late / 1000;
+    int b = 0;
+    while (us > 0 && b < PACER_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+long pacerWait(Pacer *p)
+{
+    long long deadline = toNs(&p->deadline);
+
+    // Sleep to the absolute deadline (minus the spin window), so time spent
+    // between wakeups does not push the following ones back
+    struct timespec wake = fromNs(deadline - p->spin);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+    long long now = nowNs();
+    while (now < deadline) now = nowNs();
+
+    long long late = now - deadline;
+    p->histogram[bucket(late)]++;
+    p->wakeups++;
+    p->totalLate += late;
+    if (late > p->maxLate) p->maxLate = late;
+
+    deadline += p->period;
+    if (deadline < now) {
+        long long missed = (now - deadline) / p->period + 1;
+        p->skipped += missed;
+        deadline += missed * p->period;
+    }
+    p->deadline = fromNs(deadline);
+    return (long) late;
+}
+
+void pacerPrint(const Pacer *p)
+{
+    long long max = 1;
+    for (int i = 0; i < PACER_BUCKETS; i++)
+        if (p->histogram[i] > max) max = p->histogram[i];
+
+    printf("PACING ERROR (period %ld usec, spin %ld usec): %lld wakeups, mean %.1f usec, "
+           "max %.1f usec, %lld ticks skipped\n",
+           p->period / 1000, p->spin / 1000, p->wakeups,
+           p->wakeups ? p->totalLate / 1000.0 / p->wakeups : 0.0, p->maxLate / 1000.0, p->skipped);
+    for (int i = 0; i < PACER_BUCKETS; i++) {
+        char label[32];
+        if (i == 0) snprintf(label, sizeof(label), "< 1 us");
+        else if (i == 1) snprintf(label, sizeof(label), "1 us");
+        else if (i == PACER_BUCKETS - 1) snprintf(label, sizeof(label), ">= %ld us", 1L << (i - 1));
+        else snprintf(label, sizeof(label), "%ld-%ld us", 1L << (i - 1), (1L << i) - 1);
+
+        int bar = (int) (p->histogram[i] * BAR_WIDTH / max);
+        char bars[BAR_WIDTH + 1];
+        memset(bars, '#', bar);
+        bars[bar] = '\0';
+        printf("%14s %10lld %s\n", label, p->histogram[i], bars);
+    }
+}
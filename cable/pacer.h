@@ -0,0 +1,47 @@
+// Tick pacing header.
+// Wakes the cable at absolute deadlines, so sleep overshoot does not add up,
+// and keeps a histogram of how late each wakeup was.
+
+#ifndef _PACER_H_
+#define _PACER_H_
+
+#include <time.h>
+
+#define PACER_BUCKETS 18 // <1 us, [1, 2) us, [2, 4) us, ..., >= 65536 us
+
+typedef struct
+{
+    struct timespec deadline;  // Next wakeup, on CLOCK_MONOTONIC
+    long period;               // ns between wakeups
+    long spin;                 // Busy-poll the last spin ns before a deadline
+    // Pacing error statistics
+    long long histogram[PACER_BUCKETS];
+    long long wakeups;
+    long long totalLate;       // ns, summed over all wakeups
+    long long maxLate;         // ns
+    long long skipped;         // Ticks dropped after falling behind
+} Pacer;
+
+// Start pacing with the first deadline one period from now.
+void pacerInit(Pacer *p, long period, long spin);
+
+// Change the period, keeping the statistics.
+void pacerSetPeriod(Pacer *p, long period);
+
+// Sleep until the next deadline, record how late the wakeup was, and move
+// the deadline one period forward. After falling more than a period
+// behind, the missed ticks are skipped rather than run back to back.
+// Return the lateness in ns.
+long pacerWait(Pacer *p);
+
+// Restart the deadlines from now, after a pause that should not count as
+// lateness (e.g. while the line was idle).
+void pacerResume(Pacer *p);
+
+// Forget the statistics.
+void pacerReset(Pacer *p);
+
+// Print the histogram of pacing errors.
+void pacerPrint(const Pacer *p);
+
+#endif // _PACER_H_
@@ -0,0 +1,108 @@
+// Binary trace implementation
+
+#include "trace.h"
+
+#include <sched.h>
+#include <string.h>
+
+#define TRACE_RING_SLOTS 128
+#define TRACE_SLOT_SIZE (sizeof(TraceBatch) + 2 * TRACE_STREAMS * TRACE_MAX_BYTES)
+
+static size_t batchLength(const TraceBatch *b)
+{
+    size_t n = sizeof(TraceBatch);
+    for (int i = 0; i < TRACE_STREAMS; i++) n += 2 * b->count[i];
+    return n;
+}
+
+static void *writerThread(void *arg)
+{
+    Trace *t = arg;
+    while (1) {
+        TraceBatch *b = ringReadSlot(&t->ring);
+        if (b->event == TraceEnd) {
+            ringPop(&t->ring);
+            break;
+        }
+        fwrite(b, batchLength(b), 1, t->file);
+        ringPop(&t->ring);
+    }
+    return NULL;
+}
+
+int traceOpen(Trace *t, const char *filename, long long now, long baudRate, int wait)
+{
+    memset(t, 0, sizeof(*t));
+    t->start = now;
+    t->wait = wait;
+    t->file = fopen(filename, "wb");
+    if (t->file == NULL) return -1;
+
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.batchSize = sizeof(TraceBatch);
+    header.baudRate = baudRate;
+    fwrite(&header, sizeof(header), 1, t->file);
+
+    if (ringInit(&t->ring, TRACE_RING_SLOTS, TRACE_SLOT_SIZE) == -1) {
+        fclose(t->file);
+        return -1;
+    }
+
+    // The writer must not compete with the real-time tick loop
+    pthread_attr_t attr;
+    struct sched_param sp = {.sched_priority = 0};
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &sp);
+    int res = pthread_create(&t->writer, &attr, writerThread, t);
+    pthread_attr_destroy(&attr);
+    if (res != 0) {
+        ringDestroy(&t->ring);
+        fclose(t->file);
+        return -1;
+    }
+    return 0;
+}
+
+int traceBatch(Trace *t, long long now, TraceEvent event, const unsigned char *bytes[TRACE_STREAMS],
+               const unsigned char *flags[TRACE_STREAMS], const int count[TRACE_STREAMS])
+{
+    TraceBatch *b = t->wait ? ringWriteSlot(&t->ring) : ringTryWriteSlot(&t->ring);
+    if (b == NULL) {
+        t->lost++;
+        t->lostTotal++;
+        return -1;
+    }
+
+    b->time = now - t->start;
+    b->event = event;
+    b->lost = t->lost;
+    unsigned char *p = (unsigned char *) (b + 1);
+    for (int i = 0; i < TRACE_STREAMS; i++) {
+        int n = count[i] < TRACE_MAX_BYTES ? count[i] : TRACE_MAX_BYTES;
+        b->count[i] = n;
+        memcpy(p, bytes[i], n);
+        if (flags[i] != NULL) memcpy(p + n, flags[i], n);
+        else memset(p + n, 0, n);
+        p += 2 * n;
+    }
+    ringPush(&t->ring);
+    t->lost = 0;
+    t->batches++;
+    return 0;
+}
+
+void traceClose(Trace *t)
+{
+    TraceBatch *b = ringWriteSlot(&t->ring);
+    b->event = TraceEnd;
+    ringPush(&t->ring);
+    pthread_join(t->writer, NULL);
+    ringDestroy(&t->ring);
+    fclose(t->file);
+    t->file = NULL;
+}
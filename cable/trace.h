@@ -0,0 +1,94 @@
+// Binary trace header.
+// Records what the cable moves, tick by tick, without slowing the tick loop
+// down: batches are copied into a ring and written to disk by a background
+// thread. bin/tracedump renders a trace as text.
+//
+// File layout: a TraceFileHeader, then one TraceBatch per recorded tick, each
+// followed, for every stream in order, by count[i] bytes and count[i] flags.
+// Integers are in host byte order.
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "channel.h"
+#include "ring.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC "CBLTRACE"
+#define TRACE_VERSION 2
+
+#define TRACE_MAX_BYTES 2048 // Per stream and batch; the rest is not recorded
+
+// Streams of a batch
+typedef enum
+{
+    TraceTxIn,   // Read from the transmitter
+    TraceRxOut,  // Written to the receiver
+    TraceRxIn,   // Read from the receiver
+    TraceTxOut,  // Written to the transmitter
+    TRACE_STREAMS
+} TraceStream;
+
+// Batch events
+typedef enum
+{
+    TraceBytes,    // Bytes moved this tick
+    TraceIdle,     // The line went idle
+    TraceCableOff, // The cable was disconnected
+    TraceEnd,      // Never on disk: tells the writer to stop
+} TraceEvent;
+
+// Byte flags
+#define TRACE_CORRUPTED CHANNEL_CORRUPTED // An error was injected
+#define TRACE_DROPPED   CHANNEL_DROPPED   // Lost in a dropout
+#define TRACE_CABLE_OFF 0x04              // Moved while the cable was off (discarded)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t batchSize;  // sizeof(TraceBatch)
+    uint32_t baudRate;   // When the trace started
+    uint32_t reserved;
+} TraceFileHeader;
+
+typedef struct
+{
+    int64_t time;                   // ns since the trace started
+    uint16_t count[TRACE_STREAMS];  // Bytes of each stream that follow
+    uint32_t event;                 // TraceEvent
+    uint32_t lost;                  // Batches dropped just before this one
+} TraceBatch;
+
+typedef struct
+{
+    FILE *file;
+    Ring ring;          // Batches waiting for the writer
+    pthread_t writer;
+    long long start;    // Time of traceOpen
+    int wait;           // Wait for the writer rather than drop batches
+    unsigned lost;      // Batches dropped since the last one recorded
+    long long batches;  // Statistics
+    long long lostTotal;
+} Trace;
+
+// Create filename and start the writer thread; now is the time origin.
+// If wait is TRUE, traceBatch waits for the writer instead of dropping
+// batches (when the caller's timing does not depend on the wall clock).
+// Return 0 on success or -1 on error.
+int traceOpen(Trace *t, const char *filename, long long now, long baudRate, int wait);
+
+// Record a batch. bytes[i] and flags[i] hold count[i] entries; flags[i] may
+// be NULL for no flags. Unless the trace was opened to wait, never blocks:
+// if the writer is behind, the batch is dropped and counted in the next one.
+// Return 0 if recorded or -1 if dropped.
+int traceBatch(Trace *t, long long now, TraceEvent event, const unsigned char *bytes[TRACE_STREAMS],
+               const unsigned char *flags[TRACE_STREAMS], const int count[TRACE_STREAMS]);
+
+// Write what is queued, stop the writer and close the file.
+void traceClose(Trace *t);
+
+#endif // _TRACE_H_
@@ -0,0 +1,337 @@
+// Protocol-aware trace analyzer.
+// Reassembles the link layer's frames from a cable trace (FLAG/ESC rules of
+// src/utils.h) and reports where the link time went: frames of each type,
+// retransmissions, acknowledgement latency, stuffing overhead, idle line time
+// and efficiency against the line capacity.
+//
+// Byte times are rebuilt as the cable's channel places them: a byte read at a
+// tick starts when the line is free, at the earliest at that tick, and takes
+// one byte time. Bytes written by the cable are timed at the tick they left.
+
+#include "trace.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FALSE 0
+#define TRUE 1
+
+#define MAX_FRAME 65536 // Longer frames are counted as bad
+
+typedef enum
+{
+    FrameSET,
+    FrameUA,
+    FrameDISC,
+    FrameI,
+    FrameRR,
+    FrameREJ,
+    FrameBad,
+    FRAME_TYPES
+} FrameType;
+
+static const char *frameNames[FRAME_TYPES] = {"SET", "UA", "DISC", "I", "RR", "REJ", "bad"};
+static const char *streamNames[TRACE_STREAMS] = {"tx>", ">rx", "rx>", ">tx"};
+
+// One byte stream of the trace, with its deframer
+typedef struct
+{
+    unsigned char frame[MAX_FRAME];
+    int len;             // Destuffed bytes of the current frame
+    int wire;            // Stuffed bytes of the current frame
+    int inFrame;
+    int escaped;
+    long long start;     // When the current frame's first byte was sent
+    long long lineFree;  // Input streams: when the last byte finished
+
+    long long bytes;
+    long long busy;      // ns the line spent sending this stream's bytes
+    long long frames[FRAME_TYPES];
+} Stream;
+
+// What the analysis keeps across frames
+struct Analysis {
+    long long byteTime;
+    long long first;     // Time of the first and last byte on any stream
+    long long last;
+    int verbose;
+
+    // Transmitter's I-frames
+    int lastIControl;    // -1 before the first one
+    long long payload;   // Data bytes, retransmissions excluded
+    long long iFrameBytes;
+    long long iWireBytes;
+    long long iLineTime;
+    long long retransmissions;
+    long long retransmissionsAfterRej;
+    long long lastIStart;
+    long long lastRejEnd; // -1 before the first REJ
+
+    // Acknowledgements (RR/REJ) of the receiver
+    int awaitingAck;
+    long long lastIEnd;
+    long long acks;
+    long long ackTotal;
+    long long ackMin;
+    long long ackMax;
+};
+
+struct Analysis an = {.first = -1, .last = -1, .lastIControl = -1, .lastRejEnd = -1, .ackMin = -1};
+
+FrameType classify(const unsigned char *f, int len)
+{
+    if (len < 3 || len > MAX_FRAME || f[2] != BCC1(f[0], f[1])) return FrameBad;
+    switch (f[1])
+    {
+        case C_SET: return len == 3 ? FrameSET : FrameBad;
+        case C_UA: return len == 3 ? FrameUA : FrameBad;
+        case C_DISC: return len == 3 ? FrameDISC : FrameBad;
+        case C_RR_0:
+        case C_RR_1: return len == 3 ? FrameRR : FrameBad;
+        case C_REJ_0:
+        case C_REJ_1: return len == 3 ? FrameREJ : FrameBad;
+        case C_I_0:
+        case C_I_1:
+        {
+            if (len < 5) return FrameBad;
+            unsigned char bcc2 = 0;
+            for (int i = 3; i < len - 1; i++) bcc2 ^= f[i];
+            return bcc2 == f[len - 1] ? FrameI : FrameBad;
+        }
+        default: return FrameBad;
+    }
+}
+
+// Account for a complete frame of stream s that ended at time end
+void frame_done(Stream *streams, int s, long long end)
+{
+    Stream *st = &streams[s];
+    FrameType type = classify(st->frame, st->len);
+    st->frames[type]++;
+    const char *note = "";
+
+    if (s == TraceTxIn && type == FrameI)
+    {
+        an.iFrameBytes += st->len;
+        an.iWireBytes += st->wire;
+        an.iLineTime += (st->wire + 2) * an.byteTime; // With both FLAGs
+        if (st->frame[1] == an.lastIControl)
+        {
+            // The transmitter may get the REJ while the frame it rejects is
+            // still on the line, so a REJ counts from that frame's start
+            int afterRej = an.lastRejEnd > an.lastIStart;
+            an.retransmissions++;
+            if (afterRej) an.retransmissionsAfterRej++;
+            note = afterRej ? "  retransmission after REJ" : "  retransmission after timeout";
+        }
+        else
+        {
+            an.payload += st->len - 4;
+        }
+        an.lastIControl = st->frame[1];
+        an.lastIStart = st->start;
+        an.awaitingAck = TRUE;
+        an.lastIEnd = end;
+    }
+    else if ((s == TraceTxIn && type == FrameSET) || (s == TraceRxIn && type == FrameUA))
+    {
+        // A SET/UA (llopen or a keepalive) restarts the sequence numbers, so
+        // the next I-frame is new even if its N(s) matches the last one
+        an.lastIControl = -1;
+    }
+    else if (s == TraceRxIn && (type == FrameRR || type == FrameREJ))
+    {
+        if (type == FrameREJ) an.lastRejEnd = end;
+        if (an.awaitingAck && end > an.lastIEnd)
+        {
+            long long latency = end - an.lastIEnd;
+            an.awaitingAck = FALSE;
+            an.acks++;
+            an.ackTotal += latency;
+            if (an.ackMin < 0 || latency < an.ackMin) an.ackMin = latency;
+            if (latency > an.ackMax) an.ackMax = latency;
+        }
+    }
+
+    if (an.verbose)
+    {
+        printf("%12.3f ms %s %-4s", st->start / 1e6, streamNames[s], frameNames[type]);
+        if (type == FrameI) printf(" N(s)=%d", st->frame[1] == C_I_1);
+        if (type == FrameRR || type == FrameREJ) printf(" N(r)=%d", st->frame[1] & 1);
+        printf("  %d bytes (%d on the line), %.3f ms%s\n", st->len, st->wire + 2,
+               (end - st->start) / 1e6, note);
+    }
+}
+
+// Feed one byte sent (or delivered) at time t to the deframer of stream s
+void add_byte(Stream *streams, int s, unsigned char byte, long long t)
+{
+    Stream *st = &streams[s];
+    if (byte == FLAG)
+    {
+        if (st->inFrame && st->len > 0) frame_done(streams, s, t);
+        // A FLAG both closes a frame and may open the next one
+        st->inFrame = TRUE;
+        st->escaped = FALSE;
+        st->len = 0;
+        st->wire = 0;
+        st->start = t - an.byteTime;
+        return;
+    }
+    if (!st->inFrame) return;
+
+    st->wire++;
+    if (st->escaped)
+    {
+        st->escaped = FALSE;
+        if (byte == ESC_FLAG) byte = FLAG;
+        else if (byte == ESC_ESC) byte = ESC;
+    }
+    else if (byte == ESC)
+    {
+        st->escaped = TRUE;
+        return;
+    }
+    if (st->len < MAX_FRAME) st->frame[st->len] = byte;
+    st->len++;
+}
+
+void print_ms(const char *label, long long ns)
+{
+    printf("%-28s %10.3f ms\n", label, ns / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    long baudRate = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:v")) != -1)
+    {
+        if (opt == 'b') baudRate = atol(optarg);
+        else if (opt == 'v') an.verbose = TRUE;
+        else break;
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-v] [-b baud] <trace file>\n"
+                        "  -v: list every frame\n"
+                        "  -b: baud rate, if it changed after the trace started\n", argv[0]);
+        exit(1);
+    }
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (file == NULL)
+    {
+        perror(argv[optind]);
+        exit(1);
+    }
+
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.batchSize != sizeof(TraceBatch))
+    {
+        fprintf(stderr, "%s: not a cable trace (or from another version)\n", argv[optind]);
+        exit(1);
+    }
+    if (baudRate <= 0) baudRate = header.baudRate;
+    an.byteTime = 10000000000LL / baudRate;
+
+    static Stream streams[TRACE_STREAMS];
+    static unsigned char data[2 * TRACE_MAX_BYTES];
+    long long lostBatches = 0;
+    TraceBatch b;
+
+    while (fread(&b, sizeof(b), 1, file) == 1)
+    {
+        lostBatches += b.lost;
+        for (int s = 0; s < TRACE_STREAMS; s++)
+        {
+            int n = b.count[s];
+            if (n > TRACE_MAX_BYTES || fread(data, 2, n, file) != (size_t) n)
+            {
+                fprintf(stderr, "%s: truncated trace\n", argv[optind]);
+                exit(1);
+            }
+            Stream *st = &streams[s];
+            int input = s == TraceTxIn || s == TraceRxIn;
+            for (int i = 0; i < n; i++)
+            {
+                unsigned char flags = data[n + i];
+                long long t = b.time;
+                // Bytes discarded while the cable was off never used the line,
+                // and never reached the other side
+                if (flags & TRACE_CABLE_OFF)
+                {
+                    if (!input) continue;
+                }
+                else if (input)
+                {
+                    if (st->lineFree < b.time) st->lineFree = b.time;
+                    st->lineFree += an.byteTime;
+                    st->busy += an.byteTime;
+                    t = st->lineFree;
+                }
+                st->bytes++;
+                if (an.first < 0 || t - an.byteTime < an.first) an.first = t - an.byteTime;
+                if (t > an.last) an.last = t;
+                add_byte(streams, s, data[i], t);
+            }
+        }
+    }
+    fclose(file);
+
+    if (an.first < 0)
+    {
+        printf("No bytes in the trace\n");
+        return 0;
+    }
+
+    long long span = an.last - an.first;
+    printf("%s: %.3f s of traffic at %ld baud", argv[optind], span / 1e9, baudRate);
+    if (lostBatches > 0) printf(" (%lld batches not recorded, figures are partial)", lostBatches);
+    printf("\n\n");
+
+    printf("Frames          Tx->Rx sent  delivered | Rx->Tx sent  delivered\n");
+    for (int f = 0; f < FRAME_TYPES; f++)
+    {
+        printf("%-15s %11lld %10lld | %11lld %10lld\n", frameNames[f],
+               streams[TraceTxIn].frames[f], streams[TraceRxOut].frames[f],
+               streams[TraceRxIn].frames[f], streams[TraceTxOut].frames[f]);
+    }
+    printf("\n");
+
+    long long iFrames = streams[TraceTxIn].frames[FrameI];
+    printf("%-28s %10lld (%lld after REJ, %lld after timeout)\n", "I-frame retransmissions",
+           an.retransmissions, an.retransmissionsAfterRej, an.retransmissions - an.retransmissionsAfterRej);
+    if (iFrames > 0) print_ms("Mean I-frame on the line", an.iLineTime / iFrames);
+    if (an.acks > 0)
+    {
+        print_ms("Ack latency, mean", an.ackTotal / an.acks);
+        print_ms("Ack latency, min", an.ackMin);
+        print_ms("Ack latency, max", an.ackMax);
+    }
+    if (an.iFrameBytes > 0)
+    {
+        printf("%-28s %10.2f %% (%lld bytes stuffed to %lld)\n", "Stuffing overhead",
+               100.0 * (an.iWireBytes - an.iFrameBytes) / an.iFrameBytes, an.iFrameBytes, an.iWireBytes);
+    }
+    printf("\n");
+
+    const char *lineNames[2] = {"Tx->Rx", "Rx->Tx"};
+    int lineStreams[2] = {TraceTxIn, TraceRxIn};
+    for (int l = 0; l < 2; l++)
+    {
+        long long busy = streams[lineStreams[l]].busy;
+        printf("%s line: busy %.3f s (%.1f %%), idle %.3f s\n", lineNames[l], busy / 1e9,
+               span > 0 ? 100.0 * busy / span : 0.0, (span - busy) / 1e9);
+    }
+    double seconds = span / 1e9;
+    double goodput = seconds > 0 ? an.payload * 8 / seconds : 0;
+    printf("Payload: %lld bytes, %.1f bit/s, efficiency %.4f (goodput / baud rate)\n",
+           an.payload, goodput, goodput / baudRate);
+    return 0;
+}
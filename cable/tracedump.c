@@ -0,0 +1,140 @@
+// Binary trace converter.
+// Renders a trace written by the cable's "log" command as the cable's
+// original text log, or with -r as one line per byte with its time and flags.
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FALSE 0
+#define TRUE 1
+
+static const char *streamNames[TRACE_STREAMS] = {"tx>", ">rx", "rx>", ">tx"};
+
+// Print the batch as rows of the four columns, leaving out the bytes moved
+// while the cable was off (the text log never showed them).
+// Returns the number of rows printed.
+int print_rows(unsigned char *bytes[TRACE_STREAMS], unsigned char *flags[TRACE_STREAMS],
+               const int count[TRACE_STREAMS])
+{
+    char column[TRACE_STREAMS][TRACE_MAX_BYTES][3];
+    int rows[TRACE_STREAMS] = {0};
+    int nRows = 0;
+
+    for (int s = 0; s < TRACE_STREAMS; s++)
+    {
+        for (int i = 0; i < count[s]; i++)
+        {
+            if (flags[s][i] & TRACE_CABLE_OFF) continue;
+            sprintf(column[s][rows[s]++], "%02hhX", bytes[s][i]);
+        }
+        if (rows[s] > nRows) nRows = rows[s];
+    }
+
+    for (int i = 0; i < nRows; i++)
+    {
+        const char *c[TRACE_STREAMS];
+        for (int s = 0; s < TRACE_STREAMS; s++) c[s] = i < rows[s] ? column[s][i] : "  ";
+        printf("%s  %s | %s  %s\n", c[TraceTxIn], c[TraceRxOut], c[TraceRxIn], c[TraceTxOut]);
+    }
+    return nRows;
+}
+
+// Print one line per byte: time in usec, stream, byte and flags
+void print_raw(const TraceBatch *b, unsigned char *bytes[TRACE_STREAMS], unsigned char *flags[TRACE_STREAMS])
+{
+    for (int s = 0; s < TRACE_STREAMS; s++)
+    {
+        for (int i = 0; i < b->count[s]; i++)
+        {
+            printf("%12.3f %s %02hhX%s%s%s\n", b->time / 1000.0, streamNames[s], bytes[s][i],
+                   flags[s][i] & TRACE_CORRUPTED ? " corrupted" : "",
+                   flags[s][i] & TRACE_DROPPED ? " dropped" : "",
+                   flags[s][i] & TRACE_CABLE_OFF ? " cable-off" : "");
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int raw = FALSE;
+    int opt;
+    while ((opt = getopt(argc, argv, "r")) != -1)
+    {
+        if (opt == 'r') raw = TRUE;
+        else break;
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-r] <trace file>\n"
+                        "  -r: one line per byte, with its time (usec) and flags\n", argv[0]);
+        exit(1);
+    }
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (file == NULL)
+    {
+        perror(argv[optind]);
+        exit(1);
+    }
+
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.batchSize != sizeof(TraceBatch))
+    {
+        fprintf(stderr, "%s: not a cable trace (or from another version)\n", argv[optind]);
+        exit(1);
+    }
+
+    static unsigned char data[TRACE_STREAMS][2 * TRACE_MAX_BYTES];
+    unsigned char *bytes[TRACE_STREAMS], *flags[TRACE_STREAMS];
+    int count[TRACE_STREAMS];
+    int cableIdle = FALSE;
+    TraceBatch b;
+
+    if (!raw) printf("Tx->Rx | Rx->Tx\n");
+
+    while (fread(&b, sizeof(b), 1, file) == 1)
+    {
+        for (int s = 0; s < TRACE_STREAMS; s++)
+        {
+            count[s] = b.count[s];
+            bytes[s] = data[s];
+            flags[s] = data[s] + count[s];
+            if (count[s] > TRACE_MAX_BYTES || fread(data[s], 2, count[s], file) != (size_t) count[s])
+            {
+                fprintf(stderr, "%s: truncated trace\n", argv[optind]);
+                exit(1);
+            }
+        }
+
+        if (b.lost > 0) printf("(%u BATCHES NOT RECORDED)\n", b.lost);
+
+        if (raw)
+        {
+            if (b.event == TraceIdle) printf("%12.3f idle\n", b.time / 1000.0);
+            else if (b.event == TraceCableOff) printf("%12.3f cable off\n", b.time / 1000.0);
+            print_raw(&b, bytes, flags);
+        }
+        else if (b.event == TraceCableOff)
+        {
+            printf("CABLE OFF\n");
+        }
+        else if (print_rows(bytes, flags, count) > 0)
+        {
+            cableIdle = FALSE;
+        }
+        else if (cableIdle == FALSE)
+        {
+            printf("---------------\n");
+            cableIdle = TRUE;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,388 @@
+// Link daemon.
+// Keeps one link open and sends the files that local clients queue on a
+// UNIX socket, so each file costs its START and END packets instead of a
+// process start-up and the SET/UA and DISC/UA handshakes. Jobs of higher
+// priority go first, and jobs of the same priority in the order they came.
+// While the line is idle the daemon repeats the SET/UA handshake as a
+// keepalive, and brings the link back after a failure.
+// The receiving side stores every file of the session in a directory.
+
+#define _GNU_SOURCE
+
+#include "link_layer.h"
+#include "thread.h"
+#include "transfer.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define N_TRIES 3
+#define TIMEOUT 4
+#define DEFAULT_KEEPALIVE 10   // Seconds of idle line between keepalives
+#define REQUEST_SIZE (PATH_MAX + 32)
+#define REQUEST_TIMEOUT 5      // Seconds a client has to send its request
+
+// A file waiting to be sent; its client waits on the connection for the result
+typedef struct Job {
+    int id;
+    int priority;
+    char path[PATH_MAX];
+    int client;
+    struct Job *next;
+} Job;
+
+// Daemon state, shared by the link thread and the thread accepting jobs
+struct Daemon {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    Job *queue;        // By priority, then by arrival
+    int nextId;
+    int quit;
+    int quitClient;    // Connection waiting for the daemon to stop, or -1
+    int listenFd;
+    int keepalive;
+    LinkLayer link;
+};
+
+struct Daemon linkd = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+    .nextId = 1,
+    .quitClient = -1,
+    .keepalive = DEFAULT_KEEPALIVE};
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Send one line to a client; a client that went away is ignored.
+static void reply(int fd, const char *format, ...)
+{
+    char line[REQUEST_SIZE];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > (int) sizeof(line) - 1) n = sizeof(line) - 1;
+    send(fd, line, n, MSG_NOSIGNAL);
+}
+
+// Read one line, without its newline.
+// Return its length, or -1 on error or end of input.
+static int readLine(int fd, char *line, int size)
+{
+    int n = 0;
+    while (n < size - 1) {
+        char c;
+        int res = read(fd, &c, 1);
+        if (res == -1 && errno == EINTR) continue;
+        if (res == -1) return -1; // Includes the request timeout
+        if (res == 0) return n > 0 ? n : -1;
+        if (c == '\n') break;
+        line[n++] = c;
+    }
+    line[n] = '\0';
+    return n;
+}
+
+static int connectTo(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror(path);
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int listenOn(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    // A socket left by a previous run
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 64) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Take requests: "SEND <priority> <path>" queues a job, "QUIT" stops the
+// daemon once the job being sent is done.
+static void *acceptor(void *arg)
+{
+    while (TRUE) {
+        int fd = accept(linkd.listenFd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            return NULL;
+        }
+
+        // A client that connects and sends nothing must not hold up
+        // the others
+        struct timeval limit = {.tv_sec = REQUEST_TIMEOUT};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+
+        char request[REQUEST_SIZE];
+        int priority, used = 0;
+        if (readLine(fd, request, sizeof(request)) == -1) {
+            close(fd);
+            continue;
+        }
+        pthread_mutex_lock(&linkd.lock);
+        if (linkd.quit) {
+            reply(fd, "ERROR stopping\n");
+            close(fd);
+        }
+        else if (strcmp(request, "QUIT") == 0) {
+            linkd.quit = TRUE;
+            linkd.quitClient = fd;
+        }
+        else if (sscanf(request, "SEND %d %n", &priority, &used) == 1 && used > 0 && request[used] != '\0') {
+            Job *job = calloc(1, sizeof(Job));
+            if (job == NULL) {
+                reply(fd, "ERROR out of memory\n");
+                close(fd);
+            }
+            else {
+                job->id = linkd.nextId++;
+                job->priority = priority;
+                strncpy(job->path, request + used, sizeof(job->path) - 1);
+                job->client = fd;
+                Job **p = &linkd.queue;
+                while (*p != NULL && (*p)->priority >= priority) p = &(*p)->next;
+                job->next = *p;
+                *p = job;
+                reply(fd, "QUEUED %d\n", job->id);
+            }
+        }
+        else {
+            reply(fd, "ERROR bad request\n");
+            close(fd);
+        }
+        pthread_cond_signal(&linkd.changed);
+        pthread_mutex_unlock(&linkd.lock);
+    }
+    return NULL;
+}
+
+// Repeat the handshake, to check an idle link or to bring a failed one back.
+// Return TRUE if the receiver answered.
+static int checkLink(int wasUp)
+{
+    int up = llkeepalive() == 0;
+    if (up && !wasUp) printf("\nLink up again\n");
+    if (!up && wasUp) printf("\nLink down: no answer to SET\n");
+    return up;
+}
+
+static void runJob(Job *job, int *linkUp)
+{
+    printf("\nJob %d: %s (priority %d)\n", job->id, job->path, job->priority);
+    if (!*linkUp) *linkUp = checkLink(*linkUp);
+    if (!*linkUp) {
+        reply(job->client, "FAILED %d link down\n", job->id);
+        return;
+    }
+
+    double start = now();
+    long long bytes = transferSend(job->path);
+    if (bytes >= 0) {
+        reply(job->client, "DONE %d %lld bytes %.3f s\n", job->id, bytes, now() - start);
+        return;
+    }
+    reply(job->client, "FAILED %d\n", job->id);
+    // The file may be missing, or the link may have failed; either way the
+    // handshake puts both sides back in step for the next file
+    *linkUp = checkLink(*linkUp);
+}
+
+// Send the queued jobs one after the other until asked to quit.
+static void runDaemon()
+{
+    int linkUp = TRUE;
+    double lastActive = now();
+
+    pthread_mutex_lock(&linkd.lock);
+    while (!linkd.quit) {
+        if (linkd.queue == NULL) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += (time_t) (lastActive + linkd.keepalive - now()) + 1;
+            if (pthread_cond_timedwait(&linkd.changed, &linkd.lock, &deadline) != ETIMEDOUT ||
+                now() < lastActive + linkd.keepalive) continue;
+
+            pthread_mutex_unlock(&linkd.lock);
+            linkUp = checkLink(linkUp);
+            lastActive = now();
+            pthread_mutex_lock(&linkd.lock);
+            continue;
+        }
+
+        Job *job = linkd.queue;
+        linkd.queue = job->next;
+        pthread_mutex_unlock(&linkd.lock);
+        runJob(job, &linkUp);
+        close(job->client);
+        free(job);
+        lastActive = now();
+        pthread_mutex_lock(&linkd.lock);
+    }
+
+    // Jobs still queued are not sent
+    while (linkd.queue != NULL) {
+        Job *job = linkd.queue;
+        linkd.queue = job->next;
+        reply(job->client, "FAILED %d cancelled\n", job->id);
+        close(job->client);
+        free(job);
+    }
+    pthread_mutex_unlock(&linkd.lock);
+
+    if (linkUp) llclose(linkd.link);
+    reply(linkd.quitClient, "BYE\n");
+    close(linkd.quitClient);
+}
+
+// Queue files on a running daemon and wait for their results.
+// Return 0 if all of them were sent.
+static int runClient(const char *socketPath, int priority, int quit, char *files[], int nFiles)
+{
+    char line[REQUEST_SIZE];
+    if (quit) {
+        int fd = connectTo(socketPath);
+        if (fd == -1) return 1;
+        reply(fd, "QUIT\n");
+        while (readLine(fd, line, sizeof(line)) >= 0) printf("%s\n", line);
+        close(fd);
+        return 0;
+    }
+
+    // All files are queued before waiting, so the daemon orders them
+    int *fds = malloc(nFiles * sizeof(int));
+    if (fds == NULL) return 1;
+    for (int i = 0; i < nFiles; i++) {
+        char path[PATH_MAX];
+        fds[i] = -1;
+        if (realpath(files[i], path) == NULL) {
+            perror(files[i]);
+            continue;
+        }
+        fds[i] = connectTo(socketPath);
+        if (fds[i] != -1) reply(fds[i], "SEND %d %s\n", priority, path);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < nFiles; i++) {
+        int done = FALSE;
+        while (fds[i] != -1 && readLine(fds[i], line, sizeof(line)) >= 0) {
+            printf("%s: %s\n", files[i], line);
+            if (strncmp(line, "DONE", 4) == 0) done = TRUE;
+        }
+        if (!done) failed++;
+        if (fds[i] != -1) close(fds[i]);
+    }
+    free(fds);
+    return failed > 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-k seconds] <port> <baudrate> tx <socket>\n"
+           "       %s <port> <baudrate> rx <directory>\n"
+           "       %s -c <socket> [-p priority] <file>...\n"
+           "       %s -c <socket> -q\n", prog, prog, prog, prog);
+}
+
+// Arguments:
+//   -k: seconds of idle line between keepalives (10)
+//   -c: queue files on the daemon listening on this socket
+//   -p: priority of the files queued; higher goes first (0)
+//   -q: close the link and stop the daemon, after the file being sent
+int main(int argc, char *argv[])
+{
+    const char *socketPath = NULL;
+    int priority = 0, quit = FALSE;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:c:p:q")) != -1) {
+        switch (opt) {
+        case 'k': linkd.keepalive = atoi(optarg); break;
+        case 'c': socketPath = optarg; break;
+        case 'p': priority = atoi(optarg); break;
+        case 'q': quit = TRUE; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (socketPath != NULL && (quit || optind < argc)) {
+        return runClient(socketPath, priority, quit, argv + optind, argc - optind);
+    }
+    if (argc - optind != 4 || linkd.keepalive <= 0 ||
+        (strcmp(argv[optind + 2], "tx") != 0 && strcmp(argv[optind + 2], "rx") != 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    memset(&linkd.link, 0, sizeof(linkd.link));
+    strncpy(linkd.link.serialPort, argv[optind], sizeof(linkd.link.serialPort) - 1);
+    linkd.link.role = strcmp(argv[optind + 2], "tx") == 0 ? LlTx : LlRx;
+    linkd.link.baudRate = atoi(argv[optind + 1]);
+    linkd.link.nRetransmissions = N_TRIES;
+    linkd.link.timeout = TIMEOUT;
+    const char *target = argv[optind + 3];
+
+    if (linkd.link.role == LlRx) {
+        if (llopen(linkd.link) == -1) return 1;
+        int files = transferReceiveFiles(target);
+        if (files == -1) {
+            printf("Link failed\n");
+            return 1;
+        }
+        printf("\n%d files received\n", files);
+        return llclose(linkd.link) == -1;
+    }
+
+    linkd.listenFd = listenOn(target);
+    if (linkd.listenFd == -1) {
+        perror(target);
+        return 1;
+    }
+    if (llopen(linkd.link) == -1) {
+        unlink(target);
+        return 1;
+    }
+    printf("\nLink open, waiting for jobs on %s\n", target);
+
+    pthread_t thread;
+    if (spawnWithoutAlarm(&thread, acceptor, NULL) == -1) {
+        printf("Unable to start the acceptor\n");
+        unlink(target);
+        return 1;
+    }
+
+    runDaemon();
+    close(linkd.listenFd);
+    unlink(target);
+    return 0;
+}
@@ -2,15 +2,10 @@
 
 #include "application_layer.h"
 #include "link_layer.h"
+#include "transfer.h"
 
 #include <stdio.h>
-#include <math.h>
 #include <string.h>
-#include <stdlib.h>
-#include <unistd.h>
-
-int createControlPacket(int pos, const unsigned char types[], unsigned char *values[], int lengths[], int nParams, unsigned char *packet);
-int readControlpacket(int packetsize, unsigned char *packet, long int *filesize, char *name);
 
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
                       int nTries, int timeout, const char *filename)
@@ -29,176 +24,17 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
     }
     printf("\nConnection opened successfully\n");
     if(link_layer.role == LlTx){
-        FILE *file = fopen(filename, "rb");
-        if(file == NULL) {
-            printf("Can't find file \n");
-            return;
-        }
-        fseek(file, 0L, SEEK_END);
-        long int filesize = ftell(file);
-        int nBytes = 0;
-        long temp = filesize;
-        if (temp == 0) nBytes = 1;
-        else {
-            while (temp != 0) { nBytes++; temp >>= 8; }
-        }
-        unsigned char sizeBuf[sizeof(long int)];
-        for (int b = 0; b < nBytes; ++b)
-            sizeBuf[nBytes - 1 - b] = (unsigned char)((filesize >> (8 * b)) & 0xFF);
-
-        unsigned char *packet = (unsigned char*)malloc(MAX_PAYLOAD_SIZE);
-        unsigned char types[2] = {0, 1};
-        unsigned char *values[2];
-        int lengths[2];
-
-        values[0] = sizeBuf;
-        lengths[0] = nBytes;
-        values[1] = (unsigned char *) filename;
-        lengths[1] = strlen(filename);
-
-        int packetsize = createControlPacket(1, types, values, lengths, 2, packet);
-        printf("\nSending Start, %d bytes\n", packetsize);
-        if (llwrite(packet, packetsize) == -1) {
-            printf("Unable to send START\n");
+        if (transferSend(filename) == -1) {
             return;
         }
-        free(packet);
-
-        fseek(file, 0L, SEEK_SET);
-        int bytesremaining = filesize;
-        printf("Starting file transfer of %ld bytes\n", filesize);
-        while (bytesremaining > 0)
-        {
-            printf("Sending data\n");
-            int bytesread = bytesremaining > (MAX_PAYLOAD_SIZE-3) ? (MAX_PAYLOAD_SIZE-3) : bytesremaining;
-            unsigned char* frame = (unsigned char*) malloc(bytesread);
-            fread(frame, sizeof(char), bytesread, file);
-
-            unsigned char *datapacket = (unsigned char*)malloc(bytesread+3);
-            datapacket[0] = 2;
-            datapacket[1] = (bytesread) >> 8 & 0xFF;
-            datapacket[2] = (bytesread) & 0xFF;
-            memcpy((datapacket+3), frame, bytesread);
-            if(llwrite(datapacket,bytesread+3)){
-                printf("Unable to send DATA\n");
-                return;
-            }
-            bytesremaining -=bytesread;
-            printf("%d bytes remaining\n", bytesremaining);
-            free(frame);
-            free(datapacket);
-        }
-        printf("File transfer complete\n");
-        printf("\nSending End\n");
-        unsigned char *endpacket = (unsigned char*)malloc(MAX_PAYLOAD_SIZE);
-        int endpacketsize = createControlPacket(3, types, values, lengths, 2, endpacket);
-        if (llwrite(endpacket, endpacketsize) == -1) {
-            printf("Unable to send end\n");
-            return;
-        }
-        
-        free(endpacket);
-        fclose(file);
         llclose(link_layer);
     }
     else if (link_layer.role == LlRx)
     {
-        FILE *file;
-        unsigned char *packet = malloc(MAX_PAYLOAD_SIZE+100);
-        int packetsize = 0;
-        printf("\nWaiting for control packet\n");
-        while ((packetsize = llread(packet)) == -1);
-        if(packetsize == -1){
-            printf("Error reading control packet\n");
-        }else{
-            int pos = packet[0];
-            if(pos != 1){
-                printf("Expected START control packet\n");
-                return;
-            }
-            long int filesize = 0;
-            char name[256];
-            if(readControlpacket(packetsize, packet, &filesize, name) == -1){
-                printf("Error reading START control packet\n");
-                return;
-            }
-            file = fopen(filename, "wb");
-            printf("\nReceiving file: %s of size %ld bytes\n", name, filesize);
-
-            packetsize = 0;
-            while (1) {
-                while ((packetsize = llread(packet)) == -1);
-                if (packet[0] == 2)
-                {
-                    int bytesread = packet[1] << 8 | packet[2];
-                    printf("Writing %d bytes to file\n", bytesread);
-                    fwrite(packet + 3, sizeof(char), bytesread, file);
-                }
-                else if(packet[0] == 3) 
-                {
-                    long int filesize_end = 0;
-                    char filename_end[256];
-                    if(readControlpacket(packetsize, packet, &filesize_end, filename_end) == -1){
-                        printf("Error reading END control packet\n");
-                        return;
-                    }
-                    if (filesize_end != filesize || strcmp(filename_end, name) != 0) {
-                        printf("Mismatch in END control packet\n");
-                        return;
-                    }
-                    printf("Correct END packet received\n");
-                    fclose(file);
-                    free(packet);
-                    llclose(link_layer);
-                    break;
-                }
-            }
+        if (transferReceive(filename) == -1) {
+            return;
         }
+        llclose(link_layer);
     }
     else return;
 }
-int createControlPacket(int pos, const unsigned char types[], unsigned char *values[], int lengths[],
-                         int nParams, unsigned char *packet)
-{
-    int packetLen = 0;
-
-    packet[packetLen++] = (unsigned char) pos;
-    for(int i = 0; i < nParams; i++){
-        packet[packetLen++] = types[i];
-        packet[packetLen++] = (unsigned char) lengths[i];
-        memcpy(&packet[packetLen], values[i], lengths[i]);
-        packetLen += lengths[i];
-    }
-
-    return packetLen;
-}
-
-
-
-int readControlpacket(int packetsize, unsigned char *packet, long int *filesize, char *name){
-    for(int i =1; i < packetsize; ){
-        unsigned char type = packet[i++];
-        unsigned char length = packet[i++];
-        if(type == 0){ 
-            unsigned long long acc = 0;
-            if (length < 1 || length > (int)sizeof(long int))
-            {
-                printf("Invalid size length\n");
-                return -1;
-            }
-            for (int j = 0; j < length; ++j) {
-                acc = (acc << 8) | (unsigned char)packet[i + j];
-            }
-            *filesize = (long int)acc;
-            i += length;
-        } else if (type == 1){ 
-            memcpy(name, &packet[i], length);
-            name[length] = '\0';
-            i += length;
-        } else {
-            printf("Unknown parameter type\n");
-            return -1;
-        }
-    }
-    return 0;
-}
\ No newline at end of file
@@ -0,0 +1,178 @@
+// Payload compression implementation
+//
+// Blocks use the LZ4 sequence layout: a token byte holding the literal length
+// (high nibble) and match length - 4 (low nibble), optional length extension
+// bytes, the literals, and a 2-byte little-endian match offset. The last
+// sequence of a block may stop right after its literals.
+
+#include "compress.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+#define HASH_LOG 12
+#define MAX_OFFSET 65535
+#define MF_LIMIT 12       // No match starts this close to the end of the input
+#define SAMPLE_SIZE 512   // Bytes inspected by looksCompressible
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int hash32(uint32_t v)
+{
+    return (int) ((v * 2654435761U) >> (32 - HASH_LOG));
+}
+
+// Number of extension bytes needed for a length that overflows its nibble.
+static int lengthExtSize(int len)
+{
+    if (len < 15) return 0;
+    return (len - 15) / 255 + 1;
+}
+
+static int writeLengthExt(unsigned char *dst, int len)
+{
+    int n = 0;
+    len -= 15;
+    while (len >= 255) {
+        dst[n++] = 255;
+        len -= 255;
+    }
+    dst[n++] = (unsigned char) len;
+    return n;
+}
+
+static int readLengthExt(const unsigned char *src, int srcSize, int *pos, int *len)
+{
+    unsigned char b;
+    do {
+        if (*pos >= srcSize) return -1;
+        b = src[(*pos)++];
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Write one sequence; matchLen == 0 writes a literal-only (last) sequence.
+static int writeSequence(unsigned char *dst, const unsigned char *literals, int litLen,
+                         int offset, int matchLen)
+{
+    int n = 1;
+    int ml = matchLen ? matchLen - MIN_MATCH : 0;
+    dst[0] = (unsigned char) (((litLen < 15 ? litLen : 15) << 4) | (ml < 15 ? ml : 15));
+    if (litLen >= 15) n += writeLengthExt(&dst[n], litLen);
+    memcpy(&dst[n], literals, litLen);
+    n += litLen;
+    if (matchLen) {
+        dst[n++] = (unsigned char) (offset & 0xFF);
+        dst[n++] = (unsigned char) (offset >> 8);
+        if (ml >= 15) n += writeLengthExt(&dst[n], ml);
+    }
+    return n;
+}
+
+int compressBlock(const unsigned char *src, int srcSize, unsigned char *dst,
+                  int dstCapacity, int *srcConsumed)
+{
+    if (!src || !dst || !srcConsumed || srcSize < 0 || dstCapacity < 0) return -1;
+
+    int table[1 << HASH_LOG];
+    for (int i = 0; i < (1 << HASH_LOG); i++) table[i] = -1;
+
+    int ip = 0, anchor = 0, op = 0;
+    int matchLimit = srcSize - MF_LIMIT;
+    int misses = 0;
+
+    while (ip < matchLimit) {
+        uint32_t seq = read32(&src[ip]);
+        int h = hash32(seq);
+        int ref = table[h];
+        table[h] = ip;
+        if (ref < 0 || ip - ref > MAX_OFFSET || read32(&src[ref]) != seq) {
+            // Skip faster through data that keeps missing
+            ip += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+
+        while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+            ip--;
+            ref--;
+        }
+        int matchLen = MIN_MATCH;
+        while (ip + matchLen < srcSize && src[ref + matchLen] == src[ip + matchLen]) matchLen++;
+
+        int litLen = ip - anchor;
+        int cost = 1 + lengthExtSize(litLen) + litLen + 2 + lengthExtSize(matchLen - MIN_MATCH);
+        if (op + cost > dstCapacity) break;
+
+        op += writeSequence(&dst[op], &src[anchor], litLen, ip - ref, matchLen);
+        ip += matchLen;
+        anchor = ip;
+    }
+
+    // Last literals, truncated to whatever still fits
+    int litLen = srcSize - anchor;
+    int room = dstCapacity - op;
+    if (litLen > room - 1) litLen = room - 1;
+    while (litLen > 0 && 1 + lengthExtSize(litLen) + litLen > room) litLen--;
+    if (litLen > 0) op += writeSequence(&dst[op], &src[anchor], litLen, 0, 0);
+
+    *srcConsumed = anchor + (litLen > 0 ? litLen : 0);
+    return op;
+}
+
+int decompressBlock(const unsigned char *src, int srcSize, unsigned char *dst,
+                    int dstCapacity)
+{
+    if (!src || !dst || srcSize < 0) return -1;
+
+    int ip = 0, op = 0;
+    while (ip < srcSize) {
+        unsigned char token = src[ip++];
+
+        int litLen = token >> 4;
+        if (litLen == 15 && readLengthExt(src, srcSize, &ip, &litLen) == -1) return -1;
+        if (ip + litLen > srcSize || op + litLen > dstCapacity) return -1;
+        memcpy(&dst[op], &src[ip], litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == srcSize) break;
+
+        if (ip + 2 > srcSize) return -1;
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return -1;
+
+        int matchLen = token & 0x0F;
+        if (matchLen == 15 && readLengthExt(src, srcSize, &ip, &matchLen) == -1) return -1;
+        matchLen += MIN_MATCH;
+        if (op + matchLen > dstCapacity) return -1;
+        // Byte by byte: the match may overlap the bytes being produced
+        for (int i = 0; i < matchLen; i++, op++) dst[op] = dst[op - offset];
+    }
+    return op;
+}
+
+int looksCompressible(const unsigned char *data, int size)
+{
+    if (!data || size < MF_LIMIT) return 0;
+
+    int counts[256] = {0};
+    int n = size < SAMPLE_SIZE ? size : SAMPLE_SIZE;
+    int stride = size / n;
+    for (int i = 0; i < n; i++) counts[data[i * stride]]++;
+
+    long sumSquares = 0;
+    for (int i = 0; i < 256; i++) sumSquares += (long) counts[i] * counts[i];
+
+    // Uniformly random bytes give about n + n(n-1)/256; require a clearly
+    // skewed distribution before spending time on the match finder.
+    long uniform = n + (long) n * (n - 1) / 256;
+    return sumSquares * 4 > uniform * 5;
+}
@@ -0,0 +1,28 @@
+// Payload compression header.
+// LZ4-class block codec used between the application and link layers.
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+// Largest block of raw file bytes carried by a single compressed data packet.
+#define COMPRESS_BLOCK_SIZE 8192
+
+// Compress as much of src as fits in dstCapacity bytes.
+// The number of input bytes encoded by the output is stored in srcConsumed,
+// which may be less than srcSize when the destination fills up.
+// Return number of bytes written to dst, or -1 on error.
+int compressBlock(const unsigned char *src, int srcSize, unsigned char *dst,
+                  int dstCapacity, int *srcConsumed);
+
+// Decompress a block produced by compressBlock into dst.
+// Return number of bytes written to dst, or -1 if the block is malformed or
+// does not fit in dstCapacity.
+int decompressBlock(const unsigned char *src, int srcSize, unsigned char *dst,
+                    int dstCapacity);
+
+// Sample the byte distribution of data to decide whether compressing it is
+// worth the CPU time (already compressed or random data is skipped).
+// Return 1 if data looks compressible, 0 otherwise.
+int looksCompressible(const unsigned char *data, int size);
+
+#endif // _COMPRESS_H_
@@ -1,9 +1,12 @@
 // Link layer protocol implementation
 
 #include "link_layer.h"
+#include "ring.h"
 #include "serial_port.h"
 #include "utils.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <string.h>
 #include <stdio.h>
@@ -17,18 +20,113 @@
 volatile int alarmEnabled = FALSE;
 volatile int alarmCount = 0;
 static int sequenceNumber = 0;
+static int timeout = 3;
+static int nRetransmissions = 3;
+static LinkStats stats;
+
+// Receive pipeline: a deframer thread turns the byte stream into frames, an
+// acker thread validates them and answers RR/REJ, and llread takes the
+// accepted packets. The stages are joined by bounded rings, so a slow stage
+// holds back the one before it and, ultimately, the acknowledgements.
+#define RX_FRAME_QUEUE 16
+#define RX_PACKET_QUEUE 16
+#define RX_READ_SIZE 4096
+
+// Bytes between two FLAGs, destuffed: A, C, BCC1 and, for I-frames, data and BCC2
+typedef struct
+{
+    int size;
+    int valid; // FALSE after a bad escape sequence or an oversized frame
+    unsigned char bytes[MAX_PAYLOAD_SIZE + 4];
+} RawFrame;
+
+typedef enum
+{
+    DeliverPacket,
+    DeliverDisc,
+    DeliverUA,
+    DeliverError,
+} DeliveryType;
+
+typedef struct
+{
+    DeliveryType type;
+    int size;
+    unsigned char data[MAX_PAYLOAD_SIZE];
+} Delivery;
+
+static struct
+{
+    Ring frames;  // deframer -> acker
+    Ring packets; // acker -> llread
+    pthread_t deframer;
+    pthread_t acker;
+    int expectedSeq;
+    int discReceived;
+    volatile int discSent; // Repeated DISCs are then answered by the acker
+} rx;
+
+// Submission queue: llsubmit copies packets into a ring and a sender thread
+// sends them one by one with the usual stop-and-wait exchange. Packets
+// complete in the order they were submitted, so the number completed tells
+// which handles are done, and the failed ones form runs of handles.
+#define TX_SUBMIT_QUEUE 16
+
+typedef struct
+{
+    int first;
+    int last;
+} FailedRun;
+
+typedef struct
+{
+    int handle;
+    int size;
+    LlCompletion callback;
+    void *arg;
+    unsigned char data[MAX_PAYLOAD_SIZE];
+} Submission;
+
+static struct
+{
+    Ring queue; // llsubmit -> sender
+    pthread_t sender;
+    int started;
+    volatile sig_atomic_t sending; // The sender waits for an acknowledgement
+    pthread_mutex_t lock;
+    pthread_cond_t done; // Signalled as packets complete
+    int submitted;       // Handles given out so far
+    int completed;       // Packets done so far
+    int finished;        // Packets done whose callback has returned
+    FailedRun *failed;   // Failed handles, kept for llpoll
+    int nFailed;
+    int capacity;
+    int unreported;      // A packet failed since the last llflush
+} tx = {.lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
 
 
 
 int sendSupervisionFrame(LinkLayerRole role, unsigned char controlField);
 int readSupervisionFrame(LinkLayerRole role, unsigned char c);
-int sendIFrame(const unsigned char *data, int datasize, int seqNumber);
-int readIFrame(LinkLayerRole role, unsigned char *dest, int *destsize, int seqNumber);
+int readResponseFrame();
+int buildIFrame(const unsigned char *header, int headerSize, const unsigned char *payload,
+                int payloadSize, int seqNumber, unsigned char *frame);
+int writeFrame(const unsigned char *frame, int frameSize);
+int sendIFrame(const unsigned char *header, int headerSize, const unsigned char *payload, int payloadSize);
+int startSender();
+void stopSender();
+void *senderThread(void *arg);
+void recordFailure(int handle);
+int startReceivePipeline();
+void stopReceivePipeline();
+void *deframerThread(void *arg);
+void *ackerThread(void *arg);
+void handleFrame(const RawFrame *frame);
+void deliver(DeliveryType type, const unsigned char *data, int size);
 void alarmHandler(int signal);
 void setupAlarm();
 int replaceByte(unsigned char byte, unsigned char *res);
-int destuffBytes(unsigned char *data, int dataSize, unsigned char *dest);
-int stuffBytes(unsigned char *data, int dataSize, unsigned char *dest);
+int stuffBytes(const unsigned char *data, int dataSize, unsigned char *dest, unsigned char *bcc2);
 int createBCC2 (const unsigned char *data, int dataSize);
 
 
@@ -40,6 +138,11 @@ int llopen(LinkLayer connectionParameters){
     if (openSerialPort(connectionParameters.serialPort, connectionParameters.baudRate) == -1) 
         return -1;
 
+    memset(&stats, 0, sizeof(stats));
+    sequenceNumber = 0;
+    timeout = connectionParameters.timeout;
+    nRetransmissions = connectionParameters.nRetransmissions;
+
     if (connectionParameters.role == LlTx) {
         setupAlarm();
         while (alarmCount < connectionParameters.nRetransmissions) {
@@ -47,7 +150,7 @@ int llopen(LinkLayer connectionParameters){
                 return -1;
             }
             printf("\nSended set\n");
-            alarm(3);
+            alarm(timeout);
             alarmEnabled = TRUE;
             
             int UA = FALSE;
@@ -79,6 +182,11 @@ int llopen(LinkLayer connectionParameters){
             closeSerialPort();
             return -1;
         }
+
+        if (startReceivePipeline() == -1) {
+            closeSerialPort();
+            return -1;
+        }
         
         printf("\nConnection established! \n");
         return 0;
@@ -91,85 +199,212 @@ int llopen(LinkLayer connectionParameters){
 // LLWRITE
 ////////////////////////////////////////////////
 int llwrite(const unsigned char *buf, int bufSize){
-    while (alarmCount < 3) {
-        if (sendIFrame(buf, bufSize, sequenceNumber) == -1) {
+    return llwritev(buf, bufSize, NULL, 0);
+}
+
+int llwritev(const unsigned char *header, int headerSize,
+             const unsigned char *payload, int payloadSize){
+    // Submitted packets go first, and a failure among them fails this one
+    if (tx.started && llflush() == -1) {
+        return -1;
+    }
+    return sendIFrame(header, headerSize, payload, payloadSize);
+}
+
+// Send one I-frame and wait for its acknowledgement, retransmitting on
+// REJ or timeout.
+// Return number of chars written, or -1 on error.
+int sendIFrame(const unsigned char *header, int headerSize,
+               const unsigned char *payload, int payloadSize){
+    static unsigned char frame[MAX_FRAME_SIZE];
+
+    // Stuffed once; retransmissions resend the same bytes
+    int frameSize = buildIFrame(header, headerSize, payload, payloadSize, sequenceNumber, frame);
+    if (frameSize == -1) {
+        return -1;
+    }
+
+    unsigned char RR = (sequenceNumber == 0) ? C_RR_1 : C_RR_0;
+    unsigned char REJ = (sequenceNumber == 0) ? C_REJ_0 : C_REJ_1;
+    int sent = 0;
+    while (alarmCount < nRetransmissions) {
+        if (writeFrame(frame, frameSize) == -1) {
             return -1;
         }
+        if (sent++ > 0) stats.retransmissions++;
+        stats.framesSent++;
+        stats.bytesSent += frameSize;
         printf("I-Frame sent (Ns=%d)\n", sequenceNumber);
 
         alarmEnabled = TRUE;
-        alarm(3);
-        unsigned char RR = (sequenceNumber == 0) ? C_RR_1 : C_RR_0;
-        unsigned char REJ = (sequenceNumber == 0) ? C_REJ_0 : C_REJ_1;
-        while (alarmEnabled)
-        {
-            if(readSupervisionFrame(LlTx, RR) == 0) 
-            {
-                printf("Response received successfully!\n\n");
-                alarm(0); 
-                alarmEnabled = FALSE;
-                alarmCount = 0;
-                sequenceNumber = (sequenceNumber + 1) % 2;
-                return 0; 
-            }
-            else if (readSupervisionFrame(LlTx, REJ) == 0)
-            {
-                printf("Response rejected!\n");
-                break;
-            }
+        alarm(timeout);
+        int response = -1;
+        // Stale acknowledgements (e.g. a repeated RR for the previous
+        // frame) are skipped
+        while (alarmEnabled && response != RR && response != REJ)
+            response = readResponseFrame();
+
+        if (response == RR) {
+            printf("Response received successfully!\n\n");
+            alarm(0);
+            alarmEnabled = FALSE;
+            alarmCount = 0;
+            sequenceNumber = (sequenceNumber + 1) % 2;
+            return headerSize + payloadSize;
         }
+        if (response == REJ) {
+            // Resend at once instead of waiting for the timeout
+            alarm(0);
+            alarmEnabled = FALSE;
+            stats.rejReceived++;
+            printf("Response rejected!\n");
+        }
+        else stats.timeouts++;
     }
+    alarmCount = 0;
     return -1;
 }
 
+////////////////////////////////////////////////
+// LLSUBMIT
+////////////////////////////////////////////////
+int llsubmit(const unsigned char *buf, int bufSize, LlCompletion callback, void *arg){
+    if (bufSize < 0 || bufSize > MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+    if (!tx.started && startSender() == -1) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&tx.lock);
+    int handle = tx.unreported ? -1 : tx.submitted++;
+    pthread_mutex_unlock(&tx.lock);
+    if (handle == -1) {
+        return -1;
+    }
+
+    Submission *s = ringWriteSlot(&tx.queue);
+    s->handle = handle;
+    s->size = bufSize;
+    s->callback = callback;
+    s->arg = arg;
+    memcpy(s->data, buf, bufSize);
+    ringPush(&tx.queue);
+    return handle;
+}
+
+int llpoll(int handle){
+    pthread_mutex_lock(&tx.lock);
+    int result = handle >= tx.completed ? 0 : 1;
+    if (handle < 0 || handle >= tx.submitted) result = -1;
+    for (int i = tx.nFailed - 1; result == 1 && i >= 0; i--) {
+        if (handle >= tx.failed[i].first && handle <= tx.failed[i].last) result = -1;
+    }
+    pthread_mutex_unlock(&tx.lock);
+    return result;
+}
+
+int llflush(){
+    if (!tx.started) {
+        return 0;
+    }
+    pthread_mutex_lock(&tx.lock);
+    // From a completion callback the packets left are queued behind it,
+    // so only the failures so far are reported
+    while (tx.finished < tx.submitted && !pthread_equal(pthread_self(), tx.sender))
+        pthread_cond_wait(&tx.done, &tx.lock);
+    int result = tx.unreported ? -1 : 0;
+    tx.unreported = FALSE;
+    pthread_mutex_unlock(&tx.lock);
+    return result;
+}
+
 ////////////////////////////////////////////////
 // LLREAD
 ////////////////////////////////////////////////
 
 
 int llread(unsigned char *packet){
-    unsigned char RR = (sequenceNumber == 0) ? C_RR_1 : C_RR_0;
-    unsigned char REJ = (sequenceNumber == 0) ? C_REJ_0 : C_REJ_1;
-    int packetsizeval = 0;
-    int *packetsize = &packetsizeval;
- 
-    int response = readIFrame(LlRx, packet, packetsize, sequenceNumber);
- 
-    if(response == 1){
-        if (sendSupervisionFrame(LlRx, REJ) == -1) return -1;
-        printf("Sent REJ \n\n");
-        return -1;
-    }else if(response == 0){
-        if (sendSupervisionFrame(LlRx, RR) == -1) return -1;
-        sequenceNumber = (sequenceNumber + 1) % 2;
-        printf("Sent RR \n\n");
-        return *packetsize;
-    }else{
-        printf("ERROR \n");
-        return -1;
+    if (rx.discReceived) return 0;
+
+    Delivery *delivery = ringReadSlot(&rx.packets);
+    DeliveryType type = delivery->type;
+    int size = delivery->size;
+    if (type == DeliverPacket) memcpy(packet, delivery->data, size);
+    ringPop(&rx.packets);
+
+    if (type == DeliverDisc) {
+        rx.discReceived = TRUE;
+        return 0;
+    }
+    return type == DeliverPacket ? size : -1;
+}
+
+
+////////////////////////////////////////////////
+// LLKEEPALIVE
+////////////////////////////////////////////////
+int llkeepalive(){
+    // Failures among the submitted packets are left for llflush to report
+    if (tx.started) {
+        pthread_mutex_lock(&tx.lock);
+        while (tx.completed < tx.submitted)
+            pthread_cond_wait(&tx.done, &tx.lock);
+        pthread_mutex_unlock(&tx.lock);
+    }
+    while (alarmCount < nRetransmissions) {
+        if (sendSupervisionFrame(LlTx, C_SET) == -1) {
+            return -1;
+        }
+        alarmEnabled = TRUE;
+        alarm(timeout);
+        int response = -1;
+        // Acknowledgements still on the way are skipped
+        while (alarmEnabled && response != C_UA)
+            response = readResponseFrame();
+
+        if (response == C_UA) {
+            alarm(0);
+            alarmEnabled = FALSE;
+            alarmCount = 0;
+            sequenceNumber = 0;
+            return 0;
+        }
+        stats.timeouts++;
     }
+    alarmCount = 0;
+    return -1;
 }
 
 
+////////////////////////////////////////////////
+// LLSTATS
+////////////////////////////////////////////////
+void llstats(LinkStats *out){
+    *out = stats;
+}
+
 ////////////////////////////////////////////////
 // LLCLOSE
 ////////////////////////////////////////////////
 int llclose(LinkLayer connectionParameters){
-    if (openSerialPort(connectionParameters.serialPort, connectionParameters.baudRate) == -1) 
-        return -1;
-
     printf("\nClosing connection...\n");
     if (connectionParameters.role == LlTx) {
-        while (alarmCount < connectionParameters.nRetransmissions) {
+        if (tx.started) {
+            llflush();
+            stopSender();
+        }
+        printf("Frames sent: %d (%lld bytes), retransmissions: %d, timeouts: %d, REJ received: %d\n",
+               stats.framesSent, stats.bytesSent, stats.retransmissions, stats.timeouts, stats.rejReceived);
+        int DISC = FALSE;
+        while (!DISC && alarmCount < connectionParameters.nRetransmissions) {
             if(sendSupervisionFrame(LlTx, C_DISC) == -1){
                 return -1;
             }
             printf("Sended DISC frame\n");
 
-            alarm(3);
+            alarm(timeout);
             alarmEnabled = TRUE;
-            
-            int DISC = FALSE;
 
             while (alarmEnabled && !DISC)
             {
@@ -185,21 +420,46 @@ int llclose(LinkLayer connectionParameters){
                     return -1;
                 }
                 printf("Sent UA frame\n");
-                break;
-            }  
+            }
+        }
+        alarmCount = 0;
+        if (!DISC) {
             return -1;
         }
     } else if (connectionParameters.role == LlRx) {
-        if (readSupervisionFrame(LlRx, C_DISC) == -1) {
+        // Packets still queued are discarded until the DISC, which llread
+        // may already have seen
+        unsigned char *discard = malloc(MAX_PAYLOAD_SIZE);
+        int res;
+        while ((res = llread(discard)) > 0);
+        free(discard);
+        if (res == -1) {
+            stopReceivePipeline();
             return -1;
         }
         printf("Received DISC frame\n");
-        
+
+        rx.discSent = TRUE;
         if (sendSupervisionFrame(LlRx, C_DISC) == -1) {
+            stopReceivePipeline();
             return -1;
         }
         printf("Sent DISC frame\n");
 
+        // The transmitter resends its DISC until ours gets through
+        int UA = FALSE;
+        Delivery *delivery;
+        while (!UA && (delivery = ringTimedReadSlot(&rx.packets, timeout * nRetransmissions * 1000)) != NULL) {
+            UA = (delivery->type == DeliverUA);
+            ringPop(&rx.packets);
+        }
+        stopReceivePipeline();
+        if (UA) printf("UA frame received <-\n");
+        else printf("No UA frame received, closing anyway\n");
+        printf("Frames received: %d, accepted: %d, rejected: %d, duplicates: %d\n",
+               stats.framesReceived, stats.framesAccepted, stats.rejSent, stats.duplicates);
+        printf("Max queue depth: deframer->acker %d/%d, acker->llread %d/%d\n",
+               (int) rx.frames.maxDepth, RX_FRAME_QUEUE, (int) rx.packets.maxDepth, RX_PACKET_QUEUE);
     }
 
     printf("Connection closed! \nBye, Bye!! \n");
@@ -268,103 +528,326 @@ int readSupervisionFrame(LinkLayerRole role, unsigned char c){
     return -1; 
 }
 
+// Wait for any supervision frame from the receiver until the alarm fires.
+// Return its control field, or -1 on timeout.
+int readResponseFrame(){
+    int state = 0;
+    unsigned char byte, c = 0;
+
+    while (alarmEnabled) {
+        if (readByteSerialPort(&byte) != 1) continue;
+        switch (state) {
+            case 0: // Flag
+                if (byte == FLAG) state = 1;
+                break;
+            case 1: // A
+                if (byte == A_R) state = 2;
+                else if (byte != FLAG) state = 0;
+                break;
+            case 2: // C
+                c = byte;
+                state = (byte == FLAG) ? 1 : 3;
+                break;
+            case 3: // BCC1
+                if (byte == BCC1(A_R, c)) state = 4;
+                else state = (byte == FLAG) ? 1 : 0;
+                break;
+            case 4: // Flag
+                if (byte == FLAG) return c;
+                state = 0;
+                break;
+        }
+    }
+    return -1;
+}
+
 
 
 
 
 
-int sendIFrame(const unsigned char *data, int datasize, int seqNumber){
+// Build an I-frame whose data field is header followed by payload.
+// Payload bytes are read once, by the pass that stuffs them and folds them
+// into BCC2.
+// Return the frame size, or -1 if the data does not fit in a frame.
+int buildIFrame(const unsigned char *header, int headerSize, const unsigned char *payload,
+                int payloadSize, int seqNumber, unsigned char *frame){
+    if (headerSize < 0 || payloadSize < 0 || headerSize + payloadSize > MAX_PAYLOAD_SIZE)
+        return -1;
 
-    unsigned char tmp[datasize + 1];
-    memcpy(tmp, data, datasize);
-    tmp[datasize] = (unsigned char) createBCC2(data, datasize);
+    unsigned char controlField = (seqNumber == 0) ? C_I_0 : C_I_1;
+    unsigned char bcc2 = 0x00;
+    int frameSize = 0;
 
-    int max_stuffed = 2 * (datasize + 1) + 1;
-    unsigned char *stuffed = malloc(max_stuffed);
+    frame[frameSize++] = FLAG;
+    frame[frameSize++] = A_T;
+    frame[frameSize++] = controlField;
+    frame[frameSize++] = BCC1(A_T, controlField);
+    frameSize += stuffBytes(header, headerSize, &frame[frameSize], &bcc2);
+    frameSize += stuffBytes(payload, payloadSize, &frame[frameSize], &bcc2);
+    frameSize += replaceByte(bcc2, &frame[frameSize]);
+    frame[frameSize++] = FLAG;
 
-    int stuffedsize = stuffBytes(tmp, datasize + 1, stuffed);
-    int frame_size = stuffedsize + 5;
-    int controlField;
+    return frameSize;
+}
 
-    controlField = (seqNumber == 0) ? C_I_0 : C_I_1;
+// Write a whole frame, resuming after partial writes and interruptions.
+// Return 0 on success or -1 on error.
+int writeFrame(const unsigned char *frame, int frameSize){
+    int written = 0;
+    while (written < frameSize) {
+        int res = writeBytesSerialPort(frame + written, frameSize - written);
+        if (res == -1 && errno == EINTR) continue;
+        if (res == -1) return -1;
+        written += res;
+    }
+    return 0;
+}
 
-    unsigned char frame[frame_size];
 
-    frame[0] = FLAG;
-    frame[1] = A_T;
-    frame[2] = controlField;
-    frame[3] = BCC1(A_T, controlField);
-    memcpy(&frame[4], stuffed, stuffedsize);
-    frame[frame_size - 1] = FLAG;
-    free(stuffed);
+////////////////////////////////////////////////
+// SENDER
+////////////////////////////////////////////////
+int startSender(){
+    if (ringInit(&tx.queue, TX_SUBMIT_QUEUE, sizeof(Submission)) == -1)
+        return -1;
+    // Handles, and the results llpoll reports, carry on from earlier links
+    if (pthread_create(&tx.sender, NULL, senderThread, NULL) != 0) {
+        ringDestroy(&tx.queue);
+        return -1;
+    }
+    tx.started = TRUE;
+    return 0;
+}
 
-    return writeBytesSerialPort(frame, sizeof(frame));
+void stopSender(){
+    // A submission without a handle stops the thread once the callbacks
+    // before it have returned
+    Submission *s = ringWriteSlot(&tx.queue);
+    s->handle = -1;
+    ringPush(&tx.queue);
+    pthread_join(tx.sender, NULL);
+    ringDestroy(&tx.queue);
+    tx.started = FALSE;
 }
 
+// Add handle to the failed ones: it starts a run unless it follows a
+// failure not yet reported. Called with tx.lock held.
+void recordFailure(int handle){
+    int extend = tx.unreported;
+    tx.unreported = TRUE;
+    if (!extend && tx.nFailed == tx.capacity) {
+        int capacity = tx.capacity == 0 ? 16 : 2 * tx.capacity;
+        FailedRun *runs = realloc(tx.failed, capacity * sizeof(FailedRun));
+        if (runs != NULL) {
+            tx.failed = runs;
+            tx.capacity = capacity;
+        }
+        // Out of memory: the last run grows over the packets sent since,
+        // so none that failed is reported as sent
+        else extend = tx.nFailed > 0;
+    }
+    if (extend) {
+        tx.failed[tx.nFailed - 1].last = handle;
+    }
+    else if (tx.nFailed < tx.capacity) {
+        tx.failed[tx.nFailed].first = handle;
+        tx.failed[tx.nFailed].last = handle;
+        tx.nFailed++;
+    }
+}
 
-int readIFrame(LinkLayerRole role, unsigned char *dest, int *destsize, int seqNumber){
-    unsigned char expectedA = A_T;
-    unsigned char expectedC = (seqNumber == 0) ? C_I_0 : C_I_1;
-    unsigned char bcc1[2];
-    int state = 0;
-    int tmpSize = MAX_PAYLOAD_SIZE * 2 + 8;
-    unsigned char *tmp = malloc(tmpSize);
-    int tmpLen = 0;
-    
-    printf(sequenceNumber == 0 ? "Expecting Ns=0\n" : "Expecting Ns=1\n");
-    while (TRUE)
-    {
-        unsigned char byte;
-        int res = readByteSerialPort(&byte);
-        if (res <= 0) continue;
-        switch (state)
-        {
-        case 0: // Flag
-            if (byte == FLAG) state = 1;
-            break;
-        case 1: // A
-            if (byte == expectedA) {
-                bcc1[0] = byte;
-                state = 2;
-            } 
-            else if (byte != FLAG) state = 0;
-            break;
-        case 2: // C
-            if (byte == expectedC) {
-                bcc1[1] = byte;
-                state = 3;
-            }
-            else if (byte == FLAG) state = 1;
-            else state = 0;
-            break;
-        case 3: // BCC1
-            if (byte == BCC1(bcc1[0], bcc1[1])) state = 4;
-            else if (byte == FLAG) state = 1;
-            else state = 0;
-            break;
-        case 4: //Flag, D and BCC2
+// Send the submitted packets in order and report each one.
+void *senderThread(void *arg){
+    while (TRUE) {
+        Submission *s = ringReadSlot(&tx.queue);
+        int handle = s->handle;
+        if (handle == -1) {
+            ringPop(&tx.queue);
+            return NULL;
+        }
+        pthread_mutex_lock(&tx.lock);
+        int failed = tx.unreported;
+        pthread_mutex_unlock(&tx.lock);
+
+        tx.sending = !failed;
+        int result = failed ? -1 : sendIFrame(s->data, s->size, NULL, 0);
+        tx.sending = FALSE;
+        LlCompletion callback = s->callback;
+        void *callbackArg = s->arg;
+        ringPop(&tx.queue);
+
+        // The callback sees its own packet done, in llpoll and llflush
+        pthread_mutex_lock(&tx.lock);
+        if (result == -1) recordFailure(handle);
+        tx.completed++;
+        pthread_cond_broadcast(&tx.done);
+        pthread_mutex_unlock(&tx.lock);
+        if (callback != NULL) callback(handle, result, callbackArg);
+
+        pthread_mutex_lock(&tx.lock);
+        tx.finished++;
+        pthread_cond_broadcast(&tx.done);
+        pthread_mutex_unlock(&tx.lock);
+    }
+}
+
+////////////////////////////////////////////////
+// RECEIVE PIPELINE
+////////////////////////////////////////////////
+int startReceivePipeline(){
+    memset(&rx, 0, sizeof(rx));
+    if (ringInit(&rx.frames, RX_FRAME_QUEUE, sizeof(RawFrame)) == -1)
+        return -1;
+    if (ringInit(&rx.packets, RX_PACKET_QUEUE, sizeof(Delivery)) == -1) {
+        ringDestroy(&rx.frames);
+        return -1;
+    }
+    if (pthread_create(&rx.deframer, NULL, deframerThread, NULL) != 0) {
+        ringDestroy(&rx.frames);
+        ringDestroy(&rx.packets);
+        return -1;
+    }
+    if (pthread_create(&rx.acker, NULL, ackerThread, NULL) != 0) {
+        pthread_cancel(rx.deframer);
+        pthread_join(rx.deframer, NULL);
+        ringDestroy(&rx.frames);
+        ringDestroy(&rx.packets);
+        return -1;
+    }
+    return 0;
+}
+
+void stopReceivePipeline(){
+    // Both threads block in read() or on a ring, which are cancellation points
+    pthread_cancel(rx.deframer);
+    pthread_cancel(rx.acker);
+    pthread_join(rx.deframer, NULL);
+    pthread_join(rx.acker, NULL);
+    ringDestroy(&rx.frames);
+    ringDestroy(&rx.packets);
+}
+
+// Split the received byte stream at FLAGs and destuff the frames.
+void *deframerThread(void *arg){
+    unsigned char buf[RX_READ_SIZE];
+    RawFrame *frame = NULL;
+    int escaped = FALSE;
+
+    while (TRUE) {
+        int res = readBytesSerialPort(buf, sizeof(buf));
+        if (res == -1 && errno == EINTR) continue;
+        if (res == -1) {
+            perror("read");
+            deliver(DeliverError, NULL, 0);
+            return NULL;
+        }
+
+        for (int i = 0; i < res; i++) {
+            unsigned char byte = buf[i];
             if (byte == FLAG) {
-                int destlen = destuffBytes(tmp, tmpLen, dest);
-                free(tmp);
-                if(destlen < 1) return -1;
-                int datalen = destlen - 1;
-                int bcc2 = createBCC2(dest, datalen);
-                if(bcc2 != dest[datalen]){
-                    printf("BCC2 error\n");
-                    return 1; //error send REJ
+                // Closes the current frame and opens the next one
+                if (frame != NULL && frame->size > 0) {
+                    ringPush(&rx.frames);
+                    frame = NULL;
                 }
-                *destsize = datalen;
-                return 0; //success send RR
+                if (frame == NULL) frame = ringWriteSlot(&rx.frames);
+                frame->size = 0;
+                frame->valid = TRUE;
+                escaped = FALSE;
+                continue;
+            }
+            if (frame == NULL) continue; // Hunting for the first FLAG
+
+            if (escaped) {
+                escaped = FALSE;
+                if (byte == ESC_FLAG) byte = FLAG;
+                else if (byte == ESC_ESC) byte = ESC;
+                else frame->valid = FALSE;
             }
-            else{
-                tmp[tmpLen++] = byte;
+            else if (byte == ESC) {
+                escaped = TRUE;
+                continue;
             }
-            break;
+            if (frame->size < (int) sizeof(frame->bytes)) frame->bytes[frame->size++] = byte;
+            else frame->valid = FALSE;
         }
     }
+    return NULL;
+}
+
+// Validate frames in order and acknowledge them.
+void *ackerThread(void *arg){
+    while (TRUE) {
+        RawFrame *frame = ringReadSlot(&rx.frames);
+        handleFrame(frame);
+        ringPop(&rx.frames);
+    }
+    return NULL;
+}
+
+void handleFrame(const RawFrame *frame){
+    stats.framesReceived++;
+    if (frame->size < 3) return;
+
+    unsigned char a = frame->bytes[0];
+    unsigned char c = frame->bytes[1];
+    // A damaged header cannot be answered; the transmitter will time out
+    if (a != A_T || frame->bytes[2] != BCC1(a, c)) return;
+
+    if (c == C_SET) {
+        // Our UA was lost, or the transmitter checks that we are still
+        // there; no I-frame is outstanding, so the numbering restarts
+        rx.expectedSeq = 0;
+        sendSupervisionFrame(LlRx, C_UA);
+        return;
+    }
+    if (c == C_DISC) {
+        printf("DISC frame received <-\n");
+        if (rx.discSent) sendSupervisionFrame(LlRx, C_DISC);
+        else deliver(DeliverDisc, NULL, 0);
+        return;
+    }
+    if (c == C_UA) {
+        deliver(DeliverUA, NULL, 0);
+        return;
+    }
+    if (c != C_I_0 && c != C_I_1) return;
+
+    int seq = (c == C_I_1);
+    unsigned char RR = (rx.expectedSeq == 0) ? C_RR_1 : C_RR_0;
+    unsigned char REJ = (rx.expectedSeq == 0) ? C_REJ_0 : C_REJ_1;
+    if (seq != rx.expectedSeq) {
+        // Our RR was lost and the frame was sent again: acknowledge it again
+        stats.duplicates++;
+        sendSupervisionFrame(LlRx, (rx.expectedSeq == 0) ? C_RR_0 : C_RR_1);
+        printf("Duplicate frame (Ns=%d), sent RR again\n", seq);
+        return;
+    }
+
+    int datalen = frame->size - 4;
+    if (!frame->valid || datalen < 0 ||
+        createBCC2(&frame->bytes[3], datalen) != frame->bytes[3 + datalen]) {
+        stats.rejSent++;
+        sendSupervisionFrame(LlRx, REJ);
+        printf("BCC2 error, sent REJ\n");
+        return;
+    }
+
+    // Blocks while llread is behind, holding back the RR
+    deliver(DeliverPacket, &frame->bytes[3], datalen);
+    rx.expectedSeq ^= 1;
+    stats.framesAccepted++;
+    sendSupervisionFrame(LlRx, RR);
+    printf("Sent RR (Ns=%d received)\n", seq);
+}
 
-    printf("Timeout - send REJ\n");
-    return 1; 
+void deliver(DeliveryType type, const unsigned char *data, int size){
+    Delivery *delivery = ringWriteSlot(&rx.packets);
+    delivery->type = type;
+    delivery->size = size;
+    if (size > 0) memcpy(delivery->data, data, size);
+    ringPush(&rx.packets);
 }
 
 
@@ -378,44 +861,18 @@ int createBCC2 (const unsigned char *data, int dataSize){
     return bcc2;
 }
 
-int stuffBytes(unsigned char *data, int dataSize, unsigned char *dest){
-    int max_size = 2 * dataSize + 8;
-
+// Stuff data into dest, folding each byte into bcc2 in the same pass.
+// Return the number of bytes written to dest.
+int stuffBytes(const unsigned char *data, int dataSize, unsigned char *dest, unsigned char *bcc2){
     int dest_size = 0;
     for(int i =0; i < dataSize; i++){
         unsigned char temp = data[i];
-        int size_added = replaceByte(temp, &dest[dest_size]);
-
-        if(size_added == -1) return -1;
-        if(dest_size + size_added > max_size) return -1;
-
-        dest_size += size_added;
-        
+        *bcc2 ^= temp;
+        dest_size += replaceByte(temp, &dest[dest_size]);
     }
     return dest_size;
 }
 
-int destuffBytes(unsigned char *data, int dataSize, unsigned char *dest){
-
-    if (!data || !dest || dataSize < 0) return -1;
-
-    int dest_size = 0;
-
-    for(int i =0; i < dataSize; i++){
-        if(data[i] == ESC){
-            if (i + 1 >= dataSize) return -1;
-            if(data[i + 1] == ESC_FLAG) dest[dest_size++] = FLAG;
-            else if(data[i + 1] == ESC_ESC) dest[dest_size++] = ESC;
-            else return -1; 
-            i++;
-        }
-        else dest[dest_size++] = data[i];
-    }
-    return dest_size;
-
-}
-
-
 int replaceByte(unsigned char byte, unsigned char *res){
     if(!res) return -1;
 
@@ -439,6 +896,12 @@ int replaceByte(unsigned char byte, unsigned char *res){
 
 void alarmHandler(int signal)
 {
+    // Only the alarm interrupts the sender's read(), so it is passed on
+    // when another thread got it
+    if (tx.sending && !pthread_equal(pthread_self(), tx.sender)) {
+        pthread_kill(tx.sender, SIGALRM);
+        return;
+    }
     alarmEnabled = FALSE;
     alarmCount++;
 
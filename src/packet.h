@@ -0,0 +1,34 @@
+// Data packet preparation header.
+// Turns the transmitter input into ZERO, compressed DATA and DATA packets.
+
+#ifndef _PACKET_H_
+#define _PACKET_H_
+
+#include "link_layer.h"
+#include "source.h"
+
+// Largest packet header: ZERO packets carry a 64-bit offset and length.
+#define PACKET_HEADER_MAX 17
+
+// A packet ready for llwritev: header followed by payload.
+typedef struct
+{
+    unsigned char header[PACKET_HEADER_MAX];
+    int headerSize;
+    const unsigned char *payload;           // Into the file mapping or buffer
+    int payloadSize;
+    long long offset;                       // Input offset after this packet
+    unsigned char buffer[MAX_PAYLOAD_SIZE]; // Payload storage when not mapped
+} Packet;
+
+// Prepare the packet carrying the next bytes of src, consuming them.
+// Return 1 if a packet was prepared, 0 at end of input or -1 on a read error.
+int prepareNextPacket(Source *src, int codec, Packet *packet);
+
+// Store value in the nBytes bytes of dest, most significant byte first.
+void writeNumber(unsigned char *dest, unsigned long long value, int nBytes);
+
+// Read a number stored by writeNumber.
+unsigned long long readNumber(const unsigned char *src, int nBytes);
+
+#endif // _PACKET_H_
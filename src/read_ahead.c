@@ -0,0 +1,69 @@
+// Transmitter read-ahead implementation
+
+#include "read_ahead.h"
+#include "thread.h"
+
+#include <stdlib.h>
+
+typedef struct
+{
+    int status; // prepareNextPacket result
+    Packet packet;
+} Slot;
+
+static void *producer(void *arg)
+{
+    ReadAhead *ra = arg;
+
+    while (TRUE) {
+        Slot *slot = ringWriteSlot(&ra->ring);
+        if (ra->stop) break;
+
+        slot->status = prepareNextPacket(ra->src, ra->codec, &slot->packet);
+        ringPush(&ra->ring);
+        if (slot->status <= 0) break;
+    }
+    return NULL;
+}
+
+ReadAhead *readAheadStart(Source *src, int codec)
+{
+    ReadAhead *ra = calloc(1, sizeof(ReadAhead));
+    if (ra == NULL) return NULL;
+    ra->src = src;
+    ra->codec = codec;
+    if (ringInit(&ra->ring, READ_AHEAD_PACKETS, sizeof(Slot)) == -1) {
+        free(ra);
+        return NULL;
+    }
+
+    if (spawnWithoutAlarm(&ra->thread, producer, ra) == -1) {
+        ringDestroy(&ra->ring);
+        free(ra);
+        return NULL;
+    }
+    return ra;
+}
+
+int readAheadNext(ReadAhead *ra, Packet **packet)
+{
+    Slot *slot = ringReadSlot(&ra->ring);
+    *packet = &slot->packet;
+    return slot->status;
+}
+
+void readAheadRelease(ReadAhead *ra)
+{
+    ringPop(&ra->ring);
+}
+
+void readAheadStop(ReadAhead *ra)
+{
+    // The producer may be blocked on a full ring or reading a stream that
+    // never ends; both are cancellation points
+    ra->stop = TRUE;
+    pthread_cancel(ra->thread);
+    pthread_join(ra->thread, NULL);
+    ringDestroy(&ra->ring);
+    free(ra);
+}
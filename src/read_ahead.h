@@ -0,0 +1,40 @@
+// Transmitter read-ahead header.
+// A producer thread reads the input and prepares the next packets while the
+// link layer waits for acknowledgements.
+
+#ifndef _READ_AHEAD_H_
+#define _READ_AHEAD_H_
+
+#include "packet.h"
+#include "ring.h"
+#include "source.h"
+
+#include <pthread.h>
+
+// Packets prepared ahead of the one being transmitted.
+#define READ_AHEAD_PACKETS 8
+
+typedef struct
+{
+    Source *src;
+    int codec;
+    Ring ring; // Prepared packets, READ_AHEAD_PACKETS deep
+    volatile int stop;
+    pthread_t thread;
+} ReadAhead;
+
+// Start preparing packets from src in a producer thread.
+// Return the read-ahead ring, or NULL on error.
+ReadAhead *readAheadStart(Source *src, int codec);
+
+// Wait for the next prepared packet and store it in packet.
+// Return 1 for a packet, 0 at end of input or -1 on a read error.
+int readAheadNext(ReadAhead *ra, Packet **packet);
+
+// Give back the packet returned by the last readAheadNext.
+void readAheadRelease(ReadAhead *ra);
+
+// Stop the producer thread and free the ring.
+void readAheadStop(ReadAhead *ra);
+
+#endif // _READ_AHEAD_H_
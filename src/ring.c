@@ -0,0 +1,93 @@
+// Bounded single-producer single-consumer ring implementation
+
+#include "ring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+static void semWait(sem_t *sem)
+{
+    while (sem_wait(sem) == -1 && errno == EINTR);
+}
+
+int ringInit(Ring *ring, int nSlots, int slotSize)
+{
+    ring->slots = malloc((size_t) nSlots * slotSize);
+    if (ring->slots == NULL) return -1;
+    ring->slotSize = slotSize;
+    ring->nSlots = nSlots;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->maxDepth, 0);
+    sem_init(&ring->filled, 0, 0);
+    sem_init(&ring->empty, 0, nSlots);
+    return 0;
+}
+
+void *ringWriteSlot(Ring *ring)
+{
+    semWait(&ring->empty);
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    return ring->slots + (size_t) (tail % ring->nSlots) * ring->slotSize;
+}
+
+void *ringTryWriteSlot(Ring *ring)
+{
+    if (sem_trywait(&ring->empty) == -1) return NULL;
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    return ring->slots + (size_t) (tail % ring->nSlots) * ring->slotSize;
+}
+
+void ringPush(Ring *ring)
+{
+    unsigned tail = atomic_fetch_add_explicit(&ring->tail, 1, memory_order_release) + 1;
+    unsigned depth = tail - atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (depth > atomic_load_explicit(&ring->maxDepth, memory_order_relaxed))
+        atomic_store_explicit(&ring->maxDepth, depth, memory_order_relaxed);
+    sem_post(&ring->filled);
+}
+
+void *ringReadSlot(Ring *ring)
+{
+    semWait(&ring->filled);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return ring->slots + (size_t) (head % ring->nSlots) * ring->slotSize;
+}
+
+void *ringTimedReadSlot(Ring *ring, int msec)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += msec / 1000;
+    deadline.tv_nsec += (long) (msec % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    int res;
+    while ((res = sem_timedwait(&ring->filled, &deadline)) == -1 && errno == EINTR);
+    if (res == -1) return NULL;
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return ring->slots + (size_t) (head % ring->nSlots) * ring->slotSize;
+}
+
+void ringPop(Ring *ring)
+{
+    atomic_fetch_add_explicit(&ring->head, 1, memory_order_release);
+    sem_post(&ring->empty);
+}
+
+int ringDepth(Ring *ring)
+{
+    return (int) (atomic_load(&ring->tail) - atomic_load(&ring->head));
+}
+
+void ringDestroy(Ring *ring)
+{
+    sem_destroy(&ring->filled);
+    sem_destroy(&ring->empty);
+    free(ring->slots);
+    ring->slots = NULL;
+}
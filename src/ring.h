@@ -0,0 +1,52 @@
+// Bounded single-producer single-consumer ring header.
+// Hands fixed-size slots between two threads. Slot indices are advanced with
+// atomics; a side only sleeps (on a semaphore) when the ring is full or empty.
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <semaphore.h>
+#include <stdatomic.h>
+
+typedef struct
+{
+    unsigned char *slots;
+    int slotSize;
+    int nSlots;
+    atomic_uint head;     // Slots taken by the consumer so far
+    atomic_uint tail;     // Slots published by the producer so far
+    atomic_uint maxDepth; // Highest number of filled slots seen
+    sem_t filled;         // Slots ready for the consumer
+    sem_t empty;          // Slots free for the producer
+} Ring;
+
+// Allocate a ring of nSlots slots of slotSize bytes each.
+// Return 0 on success or -1 on error.
+int ringInit(Ring *ring, int nSlots, int slotSize);
+
+// Producer: wait for a free slot and return it.
+void *ringWriteSlot(Ring *ring);
+
+// Producer: like ringWriteSlot, but return NULL at once if the ring is full.
+void *ringTryWriteSlot(Ring *ring);
+
+// Producer: publish the slot returned by ringWriteSlot.
+void ringPush(Ring *ring);
+
+// Consumer: wait for the next published slot and return it.
+void *ringReadSlot(Ring *ring);
+
+// Consumer: like ringReadSlot, but give up after msec milliseconds.
+// Return the slot, or NULL on timeout.
+void *ringTimedReadSlot(Ring *ring, int msec);
+
+// Consumer: give back the slot returned by ringReadSlot.
+void ringPop(Ring *ring);
+
+// Number of published slots not yet given back by the consumer.
+int ringDepth(Ring *ring);
+
+// Free the ring; neither side may be using it.
+void ringDestroy(Ring *ring);
+
+#endif // _RING_H_
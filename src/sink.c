@@ -0,0 +1,164 @@
+// Receiver output implementation
+
+#define _GNU_SOURCE // fallocate
+#define _FILE_OFFSET_BITS 64
+
+#include "sink.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+typedef enum
+{
+    BlockData,
+    BlockZeros,
+    BlockStop,
+} BlockType;
+
+typedef struct
+{
+    BlockType type;
+    long long offset;
+    long long size;
+    unsigned char data[SINK_BLOCK_SIZE];
+} Block;
+
+// Write all of buf at offset (or at the current position if not seekable).
+static int writeAll(Sink *sink, const unsigned char *buf, long long size, long long offset)
+{
+    while (size > 0) {
+        ssize_t res = sink->seekable ? pwrite(sink->fd, buf, size, offset)
+                                     : write(sink->fd, buf, size);
+        if (res == -1 && errno == EINTR) continue;
+        if (res == -1) return -1;
+        buf += res;
+        size -= res;
+        offset += res;
+    }
+    return 0;
+}
+
+static int writeZeros(Sink *sink, long long offset, long long count)
+{
+    static const unsigned char zeros[4096];
+
+    if (sink->seekable) {
+        // Nothing to write; give back preallocated blocks so the file stays
+        // sparse (harmless if punching holes is not supported)
+        fallocate(sink->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, count);
+        return 0;
+    }
+    while (count > 0) {
+        long long n = count > (long long) sizeof(zeros) ? (long long) sizeof(zeros) : count;
+        if (writeAll(sink, zeros, n, offset) == -1) return -1;
+        count -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void *writer(void *arg)
+{
+    Sink *sink = arg;
+
+    while (1) {
+        Block *block = ringReadSlot(&sink->queue);
+        BlockType type = block->type;
+        int res = 0;
+        if (!sink->error) {
+            if (type == BlockData) res = writeAll(sink, block->data, block->size, block->offset);
+            else if (type == BlockZeros) res = writeZeros(sink, block->offset, block->size);
+        }
+        if (res == -1) {
+            perror("write");
+            sink->error = 1;
+        }
+        ringPop(&sink->queue);
+        if (type == BlockStop) break;
+    }
+    return NULL;
+}
+
+int sinkOpen(Sink *sink, const char *filename, long long size)
+{
+    memset(sink, 0, sizeof(*sink));
+
+    // "-" writes to stdout; the progress messages move to stderr
+    if (strcmp(filename, "-") == 0) {
+        sink->fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    else sink->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (sink->fd == -1) {
+        perror(filename);
+        return -1;
+    }
+
+    struct stat st;
+    sink->seekable = fstat(sink->fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (sink->seekable && size > 0) {
+        // Reserve the space up front (best effort) so writes do not have to
+        // allocate blocks as they go
+        fallocate(sink->fd, 0, 0, size);
+    }
+
+    if (ringInit(&sink->queue, SINK_QUEUE_BLOCKS, sizeof(Block)) == -1) {
+        close(sink->fd);
+        return -1;
+    }
+
+    if (spawnWithoutAlarm(&sink->thread, writer, sink) == -1) {
+        ringDestroy(&sink->queue);
+        close(sink->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Queue a block of the given type, reusing the slot taken by sinkBuffer.
+static int queueBlock(Sink *sink, BlockType type, long long offset, long long size)
+{
+    Block *block = sink->pending != NULL ? sink->pending : ringWriteSlot(&sink->queue);
+    sink->pending = NULL;
+    block->type = type;
+    block->offset = offset;
+    block->size = size;
+    ringPush(&sink->queue);
+    return sink->error ? -1 : 0;
+}
+
+unsigned char *sinkBuffer(Sink *sink)
+{
+    if (sink->pending == NULL) sink->pending = ringWriteSlot(&sink->queue);
+    return ((Block *) sink->pending)->data;
+}
+
+int sinkCommit(Sink *sink, long long offset, int size)
+{
+    return queueBlock(sink, BlockData, offset, size);
+}
+
+int sinkZeros(Sink *sink, long long offset, long long count)
+{
+    return queueBlock(sink, BlockZeros, offset, count);
+}
+
+int sinkClose(Sink *sink, long long size)
+{
+    queueBlock(sink, BlockStop, 0, 0);
+    pthread_join(sink->thread, NULL);
+    ringDestroy(&sink->queue);
+
+    // Drops unused preallocated space and materialises trailing zeros
+    if (sink->seekable && ftruncate(sink->fd, size) == -1) {
+        perror("ftruncate");
+        sink->error = 1;
+    }
+    if (close(sink->fd) == -1) sink->error = 1;
+    return sink->error ? -1 : 0;
+}
@@ -0,0 +1,50 @@
+// Receiver output header.
+// A writer thread stores received data with pwrite at its file offset, so
+// slow disks do not hold up llread and the acknowledgements it sends.
+
+#ifndef _SINK_H_
+#define _SINK_H_
+
+#include "compress.h"
+#include "ring.h"
+
+#include <pthread.h>
+
+// Blocks queued between the application and the writer thread.
+#define SINK_QUEUE_BLOCKS 64
+
+// Largest block handed to the writer at once (a decompressed packet).
+#define SINK_BLOCK_SIZE COMPRESS_BLOCK_SIZE
+
+typedef struct
+{
+    int fd;
+    int seekable;     // Regular file: zeros become holes, size is fixed at the end
+    Ring queue;
+    void *pending;    // Queue slot taken by sinkBuffer, not yet committed
+    volatile int error;
+    pthread_t thread;
+} Sink;
+
+// Open filename ("-" for stdout) for writing and start the writer thread.
+// When size is known (>= 0) the file is preallocated.
+// Return 0 on success or -1 on error.
+int sinkOpen(Sink *sink, const char *filename, long long size);
+
+// Get a buffer of SINK_BLOCK_SIZE bytes to fill with data for sinkCommit.
+// Waits while the writer is SINK_QUEUE_BLOCKS blocks behind.
+unsigned char *sinkBuffer(Sink *sink);
+
+// Queue the size bytes placed in the sinkBuffer for writing at offset.
+// Return 0 on success or -1 if the writer has failed.
+int sinkCommit(Sink *sink, long long offset, int size);
+
+// Queue count zero bytes at offset.
+// Return 0 on success or -1 if the writer has failed.
+int sinkZeros(Sink *sink, long long offset, long long count);
+
+// Wait for all queued data to be written, set the final file size and close.
+// Return 0 on success or -1 if any write failed.
+int sinkClose(Sink *sink, long long size);
+
+#endif // _SINK_H_
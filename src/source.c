@@ -0,0 +1,130 @@
+// Transmitter input implementation
+
+#define _FILE_OFFSET_BITS 64
+
+#include "source.h"
+#include "sparse.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int sourceOpen(Source *src, const char *filename)
+{
+    memset(src, 0, sizeof(*src));
+    src->size = -1;
+    src->file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+    if (src->file == NULL) return -1;
+
+    struct stat st;
+    if (fstat(fileno(src->file), &st) == 0 && S_ISREG(st.st_mode)) {
+        src->size = st.st_size;
+        if (st.st_size > 0) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(src->file), 0);
+            if (map != MAP_FAILED) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                src->map = map;
+                src->data = src->map;
+                return 0;
+            }
+        }
+    }
+
+    // Not mappable: fall back to reading through a buffer
+    src->buffer = malloc(SOURCE_WINDOW);
+    if (src->buffer == NULL) {
+        sourceClose(src);
+        return -1;
+    }
+    src->data = src->buffer;
+    return 0;
+}
+
+int sourceFill(Source *src)
+{
+    if (src->map != NULL) {
+        long long remaining = src->size - src->offset;
+        src->datasize = remaining > SOURCE_WINDOW ? SOURCE_WINDOW : (int) remaining;
+        src->eof = remaining <= SOURCE_WINDOW;
+        return 0;
+    }
+
+    if (src->eof || src->datasize == SOURCE_WINDOW) return 0;
+    memmove(src->buffer, src->data, src->datasize);
+    src->data = src->buffer;
+
+    int toread = SOURCE_WINDOW - src->datasize;
+    int bytesread;
+    if (src->size < 0) {
+        // Streams: send what the producer has written so far
+        do {
+            bytesread = read(fileno(src->file), src->buffer + src->datasize, toread);
+        } while (bytesread == -1 && errno == EINTR);
+        if (bytesread == -1) return -1;
+        if (bytesread == 0) src->eof = 1;
+    }
+    else {
+        bytesread = fread(src->buffer + src->datasize, sizeof(char), toread, src->file);
+        if (bytesread < toread) {
+            if (ferror(src->file)) return -1;
+            src->eof = 1;
+        }
+    }
+    src->datasize += bytesread;
+    return 0;
+}
+
+void sourceConsume(Source *src, int n)
+{
+    src->data += n;
+    src->datasize -= n;
+    src->offset += n;
+}
+
+long long sourceSkipZeros(Source *src, int minRun)
+{
+    if (src->map != NULL) {
+        // Holes are skipped without touching their pages
+        long long remaining = src->size - src->offset;
+        long long run = holeLength(fileno(src->file), src->offset, remaining);
+        if (run < minRun) {
+            run = 0;
+            while (run < remaining) {
+                long long chunk = remaining - run > (1 << 30) ? (1 << 30) : remaining - run;
+                int zeros = countZeroBytes(src->map + src->offset + run, (int) chunk);
+                run += zeros;
+                if (zeros < chunk) break;
+            }
+            if (run < minRun) return 0;
+        }
+        src->offset += run;
+        src->data = src->map + src->offset;
+        src->datasize = 0;
+        return run;
+    }
+
+    int zeros = countZeroBytes(src->data, src->datasize);
+    if (zeros < minRun) return 0;
+
+    long long run = 0;
+    while (zeros == src->datasize && !src->eof) {
+        run += zeros;
+        sourceConsume(src, zeros);
+        if (sourceFill(src) == -1) return -1;
+        zeros = countZeroBytes(src->data, src->datasize);
+    }
+    run += zeros;
+    sourceConsume(src, zeros);
+    return run;
+}
+
+void sourceClose(Source *src)
+{
+    if (src->map != NULL) munmap(src->map, src->size);
+    free(src->buffer);
+    if (src->file != NULL && src->file != stdin) fclose(src->file);
+    memset(src, 0, sizeof(*src));
+}
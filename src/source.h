@@ -0,0 +1,48 @@
+// Transmitter input header.
+// Regular files are mapped into memory and sent straight from the mapping;
+// streams (stdin, pipes) are read into a buffer.
+
+#ifndef _SOURCE_H_
+#define _SOURCE_H_
+
+#include "compress.h"
+
+#include <stdio.h>
+
+// Most bytes made available at once by sourceFill; a window is compressed
+// as a whole, so it must not exceed a compression block.
+#define SOURCE_WINDOW COMPRESS_BLOCK_SIZE
+
+typedef struct
+{
+    FILE *file;
+    long long size;            // -1 if unknown until the end (streams)
+    long long offset;          // File offset of data[0]
+    unsigned char *map;        // Mapping of the whole file, or NULL
+    unsigned char *buffer;     // Read buffer when the file is not mapped
+    const unsigned char *data; // Next byte not yet sent
+    int datasize;              // Bytes available at data
+    int eof;                   // Nothing left to read after data
+} Source;
+
+// Open filename ("-" for stdin) for sending.
+// Return 0 on success or -1 on error.
+int sourceOpen(Source *src, const char *filename);
+
+// Make up to SOURCE_WINDOW bytes available at src->data.
+// Streams only wait for some bytes, not for a full window.
+// Return 0 on success or -1 on a read error; datasize is 0 at end of input.
+int sourceFill(Source *src);
+
+// Mark the first n bytes at src->data as sent.
+void sourceConsume(Source *src, int n);
+
+// Skip the run of zero bytes (or file hole) at the current offset if it is
+// at least minRun bytes long, reading past the window as needed.
+// Return the length of the skipped run, 0 if none, or -1 on a read error.
+long long sourceSkipZeros(Source *src, int minRun);
+
+// Unmap and close the input.
+void sourceClose(Source *src);
+
+#endif // _SOURCE_H_
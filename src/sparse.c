@@ -0,0 +1,84 @@
+// Zero-run detection implementation
+
+#define _GNU_SOURCE // SEEK_DATA
+#define _FILE_OFFSET_BITS 64
+
+#include "sparse.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// Distance from data to the next 8-byte aligned address.
+static int alignGap(const unsigned char *data)
+{
+    return (sizeof(uint64_t) - (uintptr_t) data % sizeof(uint64_t)) % sizeof(uint64_t);
+}
+
+int countZeroBytes(const unsigned char *data, int size)
+{
+    int i = 0;
+
+    int gap = alignGap(data);
+    while (i < size && i < gap) {
+        if (data[i] != 0) return i;
+        i++;
+    }
+    // A word at a time; the compiler vectorises this further where it can
+    while (i + (int) sizeof(uint64_t) <= size) {
+        uint64_t word;
+        memcpy(&word, &data[i], sizeof(word));
+        if (word != 0) break;
+        i += sizeof(uint64_t);
+    }
+    while (i < size && data[i] == 0) i++;
+    return i;
+}
+
+int findZeroRun(const unsigned char *data, int size, int minRun)
+{
+    int i = 0;
+
+    if (minRun < 2 * (int) sizeof(uint64_t)) {
+        while (i < size) {
+            int run = countZeroBytes(&data[i], size - i);
+            if (run > 0 && run >= minRun) return i;
+            i += run > 0 ? run : 1;
+        }
+        return size;
+    }
+
+    // Any run this long covers at least one aligned zero word, so only
+    // aligned words need to be tested.
+    i = alignGap(data);
+    while (i + (int) sizeof(uint64_t) <= size) {
+        uint64_t word;
+        memcpy(&word, &data[i], sizeof(word));
+        if (word != 0) {
+            i += sizeof(uint64_t);
+            continue;
+        }
+        int start = i;
+        while (start > 0 && data[start - 1] == 0) start--;
+        int run = countZeroBytes(&data[start], size - start);
+        if (run >= minRun) return start;
+        i = start + run;
+        i += alignGap(&data[i]);
+    }
+    return size;
+}
+
+long long holeLength(int fd, long long offset, long long limit)
+{
+#ifdef SEEK_DATA
+    off_t data = lseek(fd, offset, SEEK_DATA);
+    if (data == -1) {
+        // ENXIO: nothing but hole up to the end of the file
+        return errno == ENXIO ? limit : 0;
+    }
+    return data - offset < limit ? data - offset : limit;
+#else
+    return 0;
+#endif
+}
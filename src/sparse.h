@@ -0,0 +1,20 @@
+// Zero-run detection header.
+// Finds runs of zero bytes so they can be sent as a length instead of data.
+
+#ifndef _SPARSE_H_
+#define _SPARSE_H_
+
+// Return the number of consecutive zero bytes at the start of data.
+int countZeroBytes(const unsigned char *data, int size);
+
+// Return the position of the first run of at least minRun zero bytes in data,
+// or size if data has no such run.
+int findZeroRun(const unsigned char *data, int size, int minRun);
+
+// Ask the file system how many bytes, starting at offset, belong to a hole
+// of file descriptor fd (SEEK_DATA). The result is capped at limit.
+// Moves the file offset of fd.
+// Return the hole length, or 0 if there is no hole or holes are not supported.
+long long holeLength(int fd, long long offset, long long limit);
+
+#endif // _SPARSE_H_
@@ -0,0 +1,17 @@
+// Helper thread implementation
+
+#include "thread.h"
+
+#include <signal.h>
+
+int spawnWithoutAlarm(pthread_t *thread, void *(*start)(void *), void *arg)
+{
+    // The new thread inherits the mask of the one creating it
+    sigset_t alarmSet, oldSet;
+    sigemptyset(&alarmSet);
+    sigaddset(&alarmSet, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alarmSet, &oldSet);
+    int res = pthread_create(thread, NULL, start, arg);
+    pthread_sigmask(SIG_SETMASK, &oldSet, NULL);
+    return res == 0 ? 0 : -1;
+}
@@ -0,0 +1,15 @@
+// Helper thread header.
+// The link layer times out with SIGALRM, which must interrupt the link
+// thread's reads; helper threads are started with it blocked so the alarm
+// never lands on them.
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include <pthread.h>
+
+// Start a thread running start(arg), with SIGALRM blocked in it.
+// Return 0 on success or -1 on error.
+int spawnWithoutAlarm(pthread_t *thread, void *(*start)(void *), void *arg);
+
+#endif // _THREAD_H_
@@ -0,0 +1,689 @@
+// File transfer implementation
+
+#include "transfer.h"
+#include "link_layer.h"
+#include "compress.h"
+#include "packet.h"
+#include "read_ahead.h"
+#include "sink.h"
+#include "source.h"
+#include "utils.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// A BATCH packet is sent once less than this is left for the next DATA
+#define BATCH_MIN_ROOM 64
+
+// The file being received
+typedef struct
+{
+    Sink sink;
+    char name[256];
+    char path[PATH_MAX];  // Where it is stored
+    long long filesize;   // -1 if unknown until END
+    long long received;
+    int codec;
+} Receiver;
+
+// START and DATA packets gathered into the next BATCH packet
+typedef struct
+{
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    int size;
+} Batch;
+
+int createControlPacket(int pos, const unsigned char types[], unsigned char *values[], int lengths[], int nParams, unsigned char *packet);
+int readControlpacket(int packetsize, unsigned char *packet, long long *filesize, char *name, int *codec, long long *count);
+int encodeNumber(unsigned long long value, unsigned char *dest);
+
+// Send the file open in src, which is already announced, as DATA packets.
+// Return 0 on success or -1 on error.
+static int sendData(Source *src, int codec)
+{
+    long long filesize = src->size;
+
+    // The file is streamed until EOF, one window at a time, so it never
+    // has to fit in memory; mapped files are sent straight from the mapping.
+    // Packets are read and prepared by a producer thread while the link
+    // waits for acknowledgements.
+    ReadAhead *ra = readAheadStart(src, codec);
+    if (ra == NULL) {
+        printf("Unable to start read-ahead\n");
+        return -1;
+    }
+    while (TRUE)
+    {
+        Packet *next;
+        int status = readAheadNext(ra, &next);
+        if (status == -1) {
+            printf("Unable to read file\n");
+            readAheadStop(ra);
+            return -1;
+        }
+        if (status == 0) break;
+
+        if (next->header[0] == PKT_ZERO) printf("Sending %lld zero bytes\n", (long long) readNumber(&next->header[9], 8));
+        else printf("Sending data\n");
+        if (llwritev(next->header, next->headerSize, next->payload, next->payloadSize) == -1) {
+            printf("Unable to send DATA\n");
+            readAheadStop(ra);
+            return -1;
+        }
+        long long offset = next->offset;
+        readAheadRelease(ra);
+        if (filesize >= 0) printf("%lld bytes remaining\n", filesize - offset);
+        else printf("%lld bytes sent\n", offset);
+    }
+    readAheadStop(ra);
+    return 0;
+}
+
+// Queue the BATCH packet gathered so far, if it holds anything; the next
+// one is gathered while it is sent.
+// Return 0 on success or -1 on error.
+static int batchFlush(Batch *b)
+{
+    if (b->size > 1) {
+        printf("Sending batch, %d bytes\n", b->size);
+        if (llsubmit(b->packet, b->size, NULL, NULL) == -1) {
+            printf("Unable to send BATCH\n");
+            return -1;
+        }
+    }
+    b->packet[0] = PKT_BATCH;
+    b->size = 1;
+    return 0;
+}
+
+// Make room for a packet of size bytes in the batch, sending the batch
+// first if it is too full.
+// Return where to store the packet, or NULL on error.
+static unsigned char *batchAppend(Batch *b, int size)
+{
+    if (b->size + 2 + size > MAX_PAYLOAD_SIZE && batchFlush(b) == -1) return NULL;
+    writeNumber(&b->packet[b->size], size, 2);
+    b->size += 2 + size;
+    return &b->packet[b->size - size];
+}
+
+// Send every regular file of directory (not its subdirectories) in one
+// batch, so each file only costs its START packet, a few bytes inside the
+// frames that carry the data.
+// Return the number of bytes sent, or -1 on error.
+static long long sendBatch(const char *directory)
+{
+    struct dirent **entries;
+    int nEntries = scandir(directory, &entries, NULL, alphasort);
+    if (nEntries == -1) {
+        printf("Can't read directory\n");
+        return -1;
+    }
+
+    // Keep the regular files, and announce how many and how big
+    char path[PATH_MAX];
+    long long total = 0;
+    long long count = 0;
+    for (int i = 0; i < nEntries; i++) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", directory, entries[i]->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && strlen(entries[i]->d_name) <= 255) {
+            entries[count++] = entries[i];
+            total += st.st_size;
+        }
+        else free(entries[i]);
+    }
+
+    unsigned char countBuf[sizeof(long long)];
+    unsigned char sizeBuf[sizeof(long long)];
+    unsigned char types[3] = {T_FILECOUNT, T_FILESIZE, T_FILENAME};
+    unsigned char *values[3] = {countBuf, sizeBuf, (unsigned char *) directory};
+    int lengths[3] = {encodeNumber(count, countBuf), encodeNumber(total, sizeBuf),
+                      strlen(directory) > 255 ? 255 : strlen(directory)};
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    int packetsize = createControlPacket(PKT_MANIFEST, types, values, lengths, 3, packet);
+    printf("\nSending Manifest: %lld files, %lld bytes\n", count, total);
+
+    Batch batch = {.size = 1, .packet = {PKT_BATCH}};
+    long long sent = 0;
+    long long i = 0;
+    if (llwrite(packet, packetsize) == -1) {
+        printf("Unable to send MANIFEST\n");
+        i = -1;
+    }
+    for (; i >= 0 && i < count; i++) {
+        const char *name = entries[i]->d_name;
+        Source src;
+        snprintf(path, sizeof(path), "%s/%s", directory, name);
+        if (sourceOpen(&src, path) == -1 || src.size < 0) {
+            printf("Can't open %s\n", path);
+            break;
+        }
+
+        // The name and size travel in a START packet inside the batch
+        lengths[0] = encodeNumber(src.size, sizeBuf);
+        lengths[1] = strlen(name);
+        unsigned char startTypes[2] = {T_FILESIZE, T_FILENAME};
+        unsigned char *startValues[2] = {sizeBuf, (unsigned char *) name};
+        unsigned char *start = batchAppend(&batch, 5 + lengths[0] + lengths[1]);
+        if (start == NULL) {
+            sourceClose(&src);
+            break;
+        }
+        createControlPacket(PKT_START, startTypes, startValues, lengths, 2, start);
+        printf("Sending file %s, %lld bytes\n", name, src.size);
+
+        // Then its bytes, in DATA packets that fill the rest of each batch
+        long long offset = 0;
+        while (offset < src.size) {
+            if (src.datasize == 0 && (sourceFill(&src) == -1 || src.datasize == 0)) {
+                printf("Unable to read %s\n", path);
+                break;
+            }
+            int room = MAX_PAYLOAD_SIZE - batch.size - 2 - 3;
+            if (room < BATCH_MIN_ROOM) {
+                if (batchFlush(&batch) == -1) break;
+                continue;
+            }
+            int n = src.datasize < room ? src.datasize : room;
+            if (n > src.size - offset) n = src.size - offset;
+            unsigned char *data = batchAppend(&batch, 3 + n);
+            data[0] = PKT_DATA;
+            writeNumber(&data[1], n, 2);
+            memcpy(&data[3], src.data, n);
+            sourceConsume(&src, n);
+            offset += n;
+        }
+        long long size = src.size;
+        sourceClose(&src);
+        if (offset != size) break;
+        sent += offset;
+    }
+    int complete = i == count;
+    for (long long j = 0; j < count; j++) free(entries[j]);
+    free(entries);
+    if (!complete || batchFlush(&batch) == -1) {
+        llflush();
+        return -1;
+    }
+
+    // END repeats the totals, to be checked against what arrived. It is
+    // only sent once the queued batches are, and fails if one of them did.
+    lengths[0] = encodeNumber(count, countBuf);
+    lengths[1] = encodeNumber(sent, sizeBuf);
+    packetsize = createControlPacket(PKT_END, types, values, lengths, 2, packet);
+    printf("\nSending End\n");
+    if (llwrite(packet, packetsize) == -1) {
+        printf("Unable to send end\n");
+        return -1;
+    }
+    return sent;
+}
+
+long long transferSend(const char *filename)
+{
+    struct stat st;
+    if (stat(filename, &st) == 0 && S_ISDIR(st.st_mode)) {
+        return sendBatch(filename);
+    }
+
+    // "-" reads from stdin, e.g. the output of tar or a database dump
+    Source src;
+    if(sourceOpen(&src, filename) == -1) {
+        printf("Can't find file \n");
+        return -1;
+    }
+    // The size is only announced up front for regular files; other
+    // sources are streamed and their size is sent in END.
+    long long filesize = src.size;
+
+    int codec = USE_COMPRESSION ? CODEC_LZ : CODEC_NONE;
+    unsigned char codecBuf[1] = {(unsigned char) codec};
+    unsigned char sizeBuf[sizeof(long long)];
+
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    unsigned char types[3];
+    unsigned char *values[3];
+    int lengths[3];
+    int nParams = 0;
+
+    if (filesize >= 0) {
+        types[nParams] = T_FILESIZE;
+        values[nParams] = sizeBuf;
+        lengths[nParams++] = encodeNumber(filesize, sizeBuf);
+    }
+    types[nParams] = T_FILENAME;
+    values[nParams] = (unsigned char *) filename;
+    lengths[nParams++] = strlen(filename) > 255 ? 255 : strlen(filename);
+    if (codec != CODEC_NONE) {
+        types[nParams] = T_CODEC;
+        values[nParams] = codecBuf;
+        lengths[nParams++] = 1;
+    }
+
+    int packetsize = createControlPacket(PKT_START, types, values, lengths, nParams, packet);
+    printf("\nSending Start, %d bytes\n", packetsize);
+    if (llwrite(packet, packetsize) == -1) {
+        printf("Unable to send START\n");
+        sourceClose(&src);
+        return -1;
+    }
+
+    if (filesize >= 0) printf("Starting file transfer of %lld bytes\n", filesize);
+    else printf("Starting file transfer of unknown size\n");
+
+    if (sendData(&src, codec) == -1) {
+        sourceClose(&src);
+        return -1;
+    }
+    printf("File transfer complete\n");
+    printf("\nSending End\n");
+
+    // END always carries the number of bytes actually sent
+    types[0] = T_FILESIZE;
+    values[0] = sizeBuf;
+    lengths[0] = encodeNumber(src.offset, sizeBuf);
+    types[1] = T_FILENAME;
+    values[1] = (unsigned char *) filename;
+    lengths[1] = strlen(filename) > 255 ? 255 : strlen(filename);
+
+    int endpacketsize = createControlPacket(PKT_END, types, values, lengths, 2, packet);
+    long long sent = src.offset;
+    sourceClose(&src);
+    if (llwrite(packet, endpacketsize) == -1) {
+        printf("Unable to send end\n");
+        return -1;
+    }
+    return sent;
+}
+
+// Open the file announced by a START packet: filename or, if directory is
+// not NULL, the announced name (without its path) in directory.
+// Return 0 on success or -1 on error.
+static int beginFile(Receiver *r, unsigned char *packet, int packetsize, const char *filename,
+                     const char *directory)
+{
+    r->filesize = -1;
+    r->received = 0;
+    r->codec = CODEC_NONE;
+    if(readControlpacket(packetsize, packet, &r->filesize, r->name, &r->codec, NULL) == -1){
+        printf("Error reading START control packet\n");
+        return -1;
+    }
+
+    if (directory != NULL) {
+        const char *base = strrchr(r->name, '/') != NULL ? strrchr(r->name, '/') + 1 : r->name;
+        if (*base == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0) {
+            printf("Invalid file name %s\n", r->name);
+            return -1;
+        }
+        snprintf(r->path, sizeof(r->path), "%s/%s", directory, base);
+    }
+    else snprintf(r->path, sizeof(r->path), "%s", filename);
+
+    // Data is written by a separate thread, so llread is called (and
+    // the next frame acknowledged) without waiting for the disk
+    if (sinkOpen(&r->sink, r->path, r->filesize) == -1) {
+        printf("Unable to open output file\n");
+        return -1;
+    }
+    if (r->filesize >= 0) printf("\nReceiving file: %s of size %lld bytes\n", r->name, r->filesize);
+    else printf("\nReceiving file: %s of unknown size\n", r->name);
+    return 0;
+}
+
+// Store the contents of a DATA, compressed DATA or ZERO packet.
+// Return 0 on success or -1 on error.
+static int fileData(Receiver *r, unsigned char *packet, int packetsize)
+{
+    if (packet[0] == PKT_DATA)
+    {
+        int bytesread = packet[1] << 8 | packet[2];
+        if (bytesread > packetsize - 3) {
+            printf("Truncated DATA packet\n");
+            return -1;
+        }
+        printf("Writing %d bytes to file\n", bytesread);
+        memcpy(sinkBuffer(&r->sink), packet + 3, bytesread);
+        if (sinkCommit(&r->sink, r->received, bytesread) == -1) {
+            printf("Unable to write file\n");
+            return -1;
+        }
+        r->received += bytesread;
+    }
+    else if (packet[0] == PKT_DATA_COMPRESSED)
+    {
+        int compressedsize = packet[1] << 8 | packet[2];
+        int bytesread = packet[3] << 8 | packet[4];
+        if (r->codec != CODEC_LZ || compressedsize > packetsize - 5 ||
+            decompressBlock(packet + 5, compressedsize, sinkBuffer(&r->sink), SINK_BLOCK_SIZE) != bytesread) {
+            printf("Error decompressing DATA packet\n");
+            return -1;
+        }
+        printf("Writing %d bytes to file (%d compressed)\n", bytesread, compressedsize);
+        if (sinkCommit(&r->sink, r->received, bytesread) == -1) {
+            printf("Unable to write file\n");
+            return -1;
+        }
+        r->received += bytesread;
+    }
+    else if (packet[0] == PKT_ZERO)
+    {
+        long long offset = readNumber(packet + 1, 8);
+        long long count = readNumber(packet + 9, 8);
+        if (packetsize != 17 || offset != r->received) {
+            printf("Unexpected ZERO packet\n");
+            return -1;
+        }
+        // Left as a hole in regular files instead of writing them
+        printf("Skipping %lld zero bytes\n", count);
+        if (sinkZeros(&r->sink, offset, count) == -1) {
+            printf("Unable to write file\n");
+            return -1;
+        }
+        r->received += count;
+    }
+    else {
+        printf("Unexpected packet %d\n", packet[0]);
+        return -1;
+    }
+    if (r->filesize >= 0 && r->received > r->filesize) {
+        printf("More data than announced\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Close the file. ok is FALSE if it failed; in a directory it is then
+// removed.
+// Return 0 if the file is complete or -1 otherwise.
+static int endFile(Receiver *r, int ok, const char *directory)
+{
+    if (sinkClose(&r->sink, r->received) == -1) {
+        printf("Unable to write file\n");
+        ok = FALSE;
+    }
+    if (!ok && directory != NULL) {
+        printf("Incomplete file %s discarded\n", r->path);
+        unlink(r->path);
+    }
+    return ok ? 0 : -1;
+}
+
+// Receive the file announced by the START packet in packet.
+// *packetsize is updated with every packet read, and *received with the
+// bytes stored.
+// Return 0 at the END packet, 1 if the next START or MANIFEST came first (it
+// is left in packet), or -1 on error.
+static int receiveFile(unsigned char *packet, int *packetsize, const char *filename,
+                       const char *directory, long long *received)
+{
+    Receiver r;
+    if (beginFile(&r, packet, *packetsize, filename, directory) == -1) return -1;
+
+    int result = -1;
+    while (1) {
+        *packetsize = llread(packet);
+        if (*packetsize <= 0) {
+            printf("Connection lost before END packet\n");
+            break;
+        }
+        if (packet[0] == PKT_START || packet[0] == PKT_MANIFEST)
+        {
+            // The transmitter gave up on this file
+            printf("File %s cut short\n", r.name);
+            result = 1;
+            break;
+        }
+        else if(packet[0] == PKT_END)
+        {
+            long long filesize_end = -1;
+            char filename_end[256] = "";
+            int codec_end = CODEC_NONE;
+            if(readControlpacket(*packetsize, packet, &filesize_end, filename_end, &codec_end, NULL) == -1){
+                printf("Error reading END control packet\n");
+                break;
+            }
+            if (filesize_end != r.received || (r.filesize >= 0 && filesize_end != r.filesize) ||
+                strcmp(filename_end, r.name) != 0) {
+                printf("Mismatch in END control packet\n");
+                break;
+            }
+            printf("Correct END packet received\n");
+            result = 0;
+            break;
+        }
+        else if (fileData(&r, packet, *packetsize) == -1) {
+            break;
+        }
+    }
+
+    *received = r.received;
+    if (endFile(&r, result == 0, directory) == -1 && result == 0) result = -1;
+    return result;
+}
+
+// Receive the batch announced by the MANIFEST packet in packet, into
+// directory. *files counts the files stored.
+// Return the bytes received if the batch ended with END, or -1 on error or
+// -2 if the next START or MANIFEST came first (it is left in packet).
+static long long receiveBatch(unsigned char *packet, int *packetsize, const char *directory, int *files)
+{
+    long long count = -1, total = -1;
+    char name[256];
+    int codec = CODEC_NONE;
+    if (readControlpacket(*packetsize, packet, &total, name, &codec, &count) == -1 || count < 0) {
+        printf("Error reading MANIFEST control packet\n");
+        return -1;
+    }
+    printf("\nReceiving batch: %s, %lld files of %lld bytes\n", name, count, total);
+
+    Receiver r;
+    int open = FALSE;
+    long long received = 0;
+    long long result = -1;
+    *files = 0;
+    while (result == -1) {
+        *packetsize = llread(packet);
+        if (*packetsize <= 0) {
+            printf("Connection lost before END packet\n");
+            break;
+        }
+        if (packet[0] == PKT_START || packet[0] == PKT_MANIFEST) {
+            printf("Batch cut short\n");
+            result = -2;
+            break;
+        }
+        if (packet[0] == PKT_END) {
+            long long countEnd = -1, totalEnd = -1;
+            if (readControlpacket(*packetsize, packet, &totalEnd, name, &codec, &countEnd) == -1 ||
+                open || countEnd != *files || totalEnd != received) {
+                printf("Mismatch in END control packet\n");
+                break;
+            }
+            printf("Correct END packet received, %d files\n", *files);
+            result = received;
+            break;
+        }
+        if (packet[0] != PKT_BATCH) {
+            printf("Unexpected packet %d in a batch\n", packet[0]);
+            break;
+        }
+
+        // The packets gathered in this one, each with its length
+        int ok = TRUE;
+        for (int i = 1; ok && i < *packetsize; ) {
+            int size = i + 2 <= *packetsize ? (int) readNumber(&packet[i], 2) : -1;
+            i += 2;
+            if (size < 1 || i + size > *packetsize) {
+                printf("Truncated BATCH packet\n");
+                ok = FALSE;
+                break;
+            }
+            unsigned char *p = &packet[i];
+            i += size;
+            if (p[0] == PKT_START) {
+                if (open) {
+                    printf("File %s cut short\n", r.name);
+                    endFile(&r, FALSE, directory);
+                    open = FALSE;
+                }
+                ok = beginFile(&r, p, size, NULL, directory) == 0 && r.filesize >= 0;
+                open = ok;
+            }
+            else {
+                ok = open && fileData(&r, p, size) == 0;
+            }
+            // A file ends with its last byte
+            if (ok && r.received == r.filesize) {
+                open = FALSE;
+                ok = endFile(&r, TRUE, directory) == 0;
+                received += r.received;
+                if (ok) (*files)++;
+            }
+        }
+        if (!ok) break;
+    }
+    if (open) endFile(&r, FALSE, directory);
+    return result;
+}
+
+long long transferReceive(const char *filename)
+{
+    unsigned char *packet = malloc(MAX_PAYLOAD_SIZE + 100);
+    if (packet == NULL) return -1;
+    printf("\nWaiting for control packet\n");
+    int packetsize = llread(packet);
+    long long received = -1;
+    struct stat st;
+    int files;
+    if (packetsize <= 0) {
+        printf("Error reading control packet\n");
+    }
+    else if (packet[0] == PKT_MANIFEST) {
+        // A batch is stored in a directory
+        if (stat(filename, &st) != 0 || !S_ISDIR(st.st_mode)) printf("%s is not a directory\n", filename);
+        else received = receiveBatch(packet, &packetsize, filename, &files);
+        if (received < 0) received = -1;
+    }
+    else if (packet[0] != PKT_START) {
+        printf("Expected START control packet\n");
+    }
+    else if (receiveFile(packet, &packetsize, filename, NULL, &received) != 0) {
+        received = -1;
+    }
+    free(packet);
+    return received;
+}
+
+int transferReceiveFiles(const char *directory)
+{
+    unsigned char *packet = malloc(MAX_PAYLOAD_SIZE + 100);
+    if (packet == NULL) return -1;
+    int files = 0;
+    int pending = FALSE;
+    int packetsize = 0;
+    while (TRUE) {
+        if (!pending) {
+            printf("\nWaiting for control packet\n");
+            packetsize = llread(packet);
+        }
+        pending = FALSE;
+        if (packetsize == 0) break;
+        if (packetsize < 0) {
+            files = -1;
+            break;
+        }
+
+        long long received = 0;
+        if (packet[0] == PKT_START) {
+            int res = receiveFile(packet, &packetsize, NULL, directory, &received);
+            if (res == 0) files++;
+            else if (res == 1) pending = TRUE;
+        }
+        else if (packet[0] == PKT_MANIFEST) {
+            int batchFiles = 0;
+            received = receiveBatch(packet, &packetsize, directory, &batchFiles);
+            files += batchFiles;
+            if (received == -2) pending = TRUE;
+        }
+        else {
+            // Left over from a file that failed
+            printf("Packet outside a file skipped\n");
+        }
+    }
+    free(packet);
+    return files;
+}
+
+int createControlPacket(int pos, const unsigned char types[], unsigned char *values[], int lengths[],
+                         int nParams, unsigned char *packet)
+{
+    int packetLen = 0;
+
+    packet[packetLen++] = (unsigned char) pos;
+    for(int i = 0; i < nParams; i++){
+        packet[packetLen++] = types[i];
+        packet[packetLen++] = (unsigned char) lengths[i];
+        memcpy(&packet[packetLen], values[i], lengths[i]);
+        packetLen += lengths[i];
+    }
+
+    return packetLen;
+}
+
+// Store value in dest using as few bytes as possible, most significant first.
+// Return the number of bytes used.
+int encodeNumber(unsigned long long value, unsigned char *dest)
+{
+    int nBytes = 1;
+    while (nBytes < (int) sizeof(value) && (value >> (8 * nBytes)) != 0) nBytes++;
+    writeNumber(dest, value, nBytes);
+    return nBytes;
+}
+
+// count, if not NULL, gets the T_FILECOUNT parameter of a batch.
+int readControlpacket(int packetsize, unsigned char *packet, long long *filesize, char *name, int *codec,
+                      long long *count){
+    for(int i =1; i < packetsize; ){
+        if (i + 2 > packetsize) {
+            printf("Truncated control packet\n");
+            return -1;
+        }
+        unsigned char type = packet[i++];
+        unsigned char length = packet[i++];
+        if (i + length > packetsize) {
+            printf("Truncated control packet\n");
+            return -1;
+        }
+        if(type == T_FILESIZE || (type == T_FILECOUNT && count != NULL)){
+            if (length < 1 || length > (int)sizeof(long long) || (length == 8 && packet[i] & 0x80))
+            {
+                printf("Invalid size length\n");
+                return -1;
+            }
+            *(type == T_FILESIZE ? filesize : count) = (long long)readNumber(&packet[i], length);
+            i += length;
+        } else if (type == T_FILENAME){
+            memcpy(name, &packet[i], length);
+            name[length] = '\0';
+            i += length;
+        } else if (type == T_CODEC){
+            if (length != 1 || (packet[i] != CODEC_NONE && packet[i] != CODEC_LZ)) {
+                printf("Unsupported codec\n");
+                return -1;
+            }
+            *codec = packet[i];
+            i += length;
+        } else {
+            printf("Unknown parameter type\n");
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+// File transfer header.
+// Moves one file over an open link: a START control packet with its size,
+// name and codec, the data packets and an END packet. Files can follow each
+// other in one session, between llopen and llclose. The files of a directory
+// go in one batch: a MANIFEST packet, BATCH packets holding the START and
+// DATA packets of every file, and an END packet.
+
+#ifndef _TRANSFER_H_
+#define _TRANSFER_H_
+
+// Send filename ("-" for stdin), or the regular files of a directory.
+// Return the number of bytes sent, or -1 on error.
+long long transferSend(const char *filename);
+
+// Receive one file into filename ("-" for stdout), or a batch into the
+// directory filename.
+// Return the number of bytes received, or -1 on error.
+long long transferReceive(const char *filename);
+
+// Receive files until the transmitter closes the link, each one into
+// directory under the name in its START packet (without its path). A file
+// cut short by the start of the next one is discarded. Batches are stored
+// the same way.
+// Return the number of files received, or -1 if the link failed.
+int transferReceiveFiles(const char *directory);
+
+#endif // _TRANSFER_H_
@@ -0,0 +1,365 @@
+// Transport backend implementation
+// The termios backend lives in serial_port.c; the others are here.
+
+#define _GNU_SOURCE // ptsname_r
+
+#include "transport.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define MEM_PIPE_SIZE 65536
+#define UDP_DATAGRAM_SIZE 65536
+
+static int linkFd = -1;          // Descriptor of the pty, unix, fd and udp backends
+static int ptySlave = -1;        // Kept open so the master never reads EIO
+static char linkPath[108] = "";  // Path to remove on close (pty and unix)
+
+static const Transport *transports[] = {
+    &ptyTransport,
+    &unixTransport,
+    &fdTransport,
+    &udpTransport,
+    &memTransport,
+};
+
+const Transport *findTransport(const char *serialPort, const char **address)
+{
+    for (int i = 0; i < (int) (sizeof(transports) / sizeof(transports[0])); i++) {
+        int len = strlen(transports[i]->prefix);
+        if (strncmp(serialPort, transports[i]->prefix, len) == 0) {
+            *address = serialPort + len;
+            return transports[i];
+        }
+    }
+    *address = serialPort;
+    return &termiosTransport;
+}
+
+////////////////////////////////////////////////
+// DESCRIPTOR BACKENDS (pty, unix, fd)
+////////////////////////////////////////////////
+static int fdRead(unsigned char *bytes, int nBytes)
+{
+    return read(linkFd, bytes, nBytes);
+}
+
+static int fdWrite(const unsigned char *bytes, int nBytes)
+{
+    return write(linkFd, bytes, nBytes);
+}
+
+static int fdClose()
+{
+    if (linkPath[0] != '\0') unlink(linkPath);
+    linkPath[0] = '\0';
+    if (ptySlave != -1) close(ptySlave);
+    ptySlave = -1;
+    int res = close(linkFd);
+    linkFd = -1;
+    return res;
+}
+
+static int ptyOpen(const char *address, int baudRate)
+{
+    char slaveName[64];
+    linkFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (linkFd == -1 || grantpt(linkFd) == -1 || unlockpt(linkFd) == -1 ||
+        ptsname_r(linkFd, slaveName, sizeof(slaveName)) != 0) {
+        perror("posix_openpt");
+        if (linkFd != -1) close(linkFd);
+        return -1;
+    }
+
+    struct termios tio;
+    ptySlave = open(slaveName, O_RDWR | O_NOCTTY);
+    if (ptySlave == -1 || tcgetattr(ptySlave, &tio) == -1) {
+        perror(slaveName);
+        fdClose();
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(ptySlave, TCSANOW, &tio);
+
+    unlink(address);
+    if (symlink(slaveName, address) == -1) {
+        perror(address);
+        fdClose();
+        return -1;
+    }
+    strncpy(linkPath, address, sizeof(linkPath) - 1);
+    printf("Pseudo-terminal %s linked at %s\n", slaveName, address);
+    return linkFd;
+}
+
+static int unixOpen(const char *address, int baudRate)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(address) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", address);
+        return -1;
+    }
+    strcpy(addr.sun_path, address);
+
+    linkFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (linkFd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(linkFd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+        return linkFd;
+    if (errno != ENOENT && errno != ECONNREFUSED) {
+        perror(address);
+        close(linkFd);
+        return -1;
+    }
+
+    // Nobody is listening yet: this side waits for the other one
+    unlink(address);
+    int listener = linkFd;
+    if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(listener, 1) == -1) {
+        perror(address);
+        close(listener);
+        return -1;
+    }
+    strncpy(linkPath, address, sizeof(linkPath) - 1);
+    while ((linkFd = accept(listener, NULL, NULL)) == -1 && errno == EINTR);
+    close(listener);
+    if (linkFd == -1) {
+        perror("accept");
+        unlink(linkPath);
+        linkPath[0] = '\0';
+        return -1;
+    }
+    return linkFd;
+}
+
+static int fdOpen(const char *address, int baudRate)
+{
+    linkFd = atoi(address);
+    if (fcntl(linkFd, F_GETFD) == -1) {
+        perror(address);
+        linkFd = -1;
+        return -1;
+    }
+    return linkFd;
+}
+
+const Transport ptyTransport = {"pty:", ptyOpen, fdClose, fdRead, fdWrite};
+const Transport unixTransport = {"unix:", unixOpen, fdClose, fdRead, fdWrite};
+const Transport fdTransport = {"fd:", fdOpen, fdClose, fdRead, fdWrite};
+
+////////////////////////////////////////////////
+// UDP BACKEND
+////////////////////////////////////////////////
+// Datagrams are buffered, as the link layer may read fewer bytes than a
+// datagram holds and recv() would drop the rest.
+static unsigned char *udpBuffer = NULL;
+static int udpStart = 0;
+static int udpEnd = 0;
+
+static int udpOpen(const char *address, int baudRate)
+{
+    int localPort, peerPort;
+    if (sscanf(address, "%d:%d", &localPort, &peerPort) != 2) {
+        fprintf(stderr, "%s: expected udp:localport:peerport\n", address);
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    udpBuffer = malloc(UDP_DATAGRAM_SIZE);
+    linkFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udpBuffer == NULL || linkFd == -1) {
+        perror("socket");
+        free(udpBuffer);
+        return -1;
+    }
+    addr.sin_port = htons(localPort);
+    int res = bind(linkFd, (struct sockaddr *) &addr, sizeof(addr));
+    addr.sin_port = htons(peerPort);
+    if (res == -1 || connect(linkFd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror(address);
+        close(linkFd);
+        free(udpBuffer);
+        return -1;
+    }
+    udpStart = udpEnd = 0;
+    return linkFd;
+}
+
+static int udpClose()
+{
+    free(udpBuffer);
+    udpBuffer = NULL;
+    int res = close(linkFd);
+    linkFd = -1;
+    return res;
+}
+
+static int udpRead(unsigned char *bytes, int nBytes)
+{
+    while (udpStart == udpEnd) {
+        int res = recv(linkFd, udpBuffer, UDP_DATAGRAM_SIZE, 0);
+        // Reported for an earlier datagram sent before the peer was up
+        if (res == -1 && errno == ECONNREFUSED) continue;
+        if (res == -1) return -1;
+        udpStart = 0;
+        udpEnd = res;
+    }
+    int n = udpEnd - udpStart < nBytes ? udpEnd - udpStart : nBytes;
+    memcpy(bytes, udpBuffer + udpStart, n);
+    udpStart += n;
+    return n;
+}
+
+static int udpWrite(const unsigned char *bytes, int nBytes)
+{
+    int res = send(linkFd, bytes, nBytes, 0);
+    // Nobody listening: the bytes are lost, as on an unplugged cable
+    if (res == -1 && errno == ECONNREFUSED) return nBytes;
+    return res;
+}
+
+const Transport udpTransport = {"udp:", udpOpen, udpClose, udpRead, udpWrite};
+
+////////////////////////////////////////////////
+// IN-MEMORY PIPE BACKEND
+////////////////////////////////////////////////
+// Two byte rings in shared memory, one per direction. A side only enters
+// the kernel (on a semaphore) when its ring is empty or full, and the other
+// side only posts that semaphore when it sees the waiting flag set, so the
+// counts never pile up.
+typedef struct
+{
+    atomic_uint head;         // Bytes read so far
+    atomic_uint tail;         // Bytes written so far
+    atomic_int readerWaiting; // The reader found the ring empty
+    atomic_int writerWaiting; // The writer found the ring full
+    sem_t readable;
+    sem_t writable;
+    unsigned char data[MEM_PIPE_SIZE];
+} MemRing;
+
+static MemRing *memRings = NULL; // memRings[i] carries the bytes written by side i
+static int memSide = 0;
+
+// Copy n bytes between a buffer and the ring at position pos, wrapping around.
+static void memCopy(unsigned char *dst, const unsigned char *src, unsigned pos, int n, int toRing)
+{
+    int offset = pos % MEM_PIPE_SIZE;
+    int first = MEM_PIPE_SIZE - offset < n ? MEM_PIPE_SIZE - offset : n;
+    if (toRing) {
+        memcpy(dst + offset, src, first);
+        memcpy(dst, src + first, n - first);
+    } else {
+        memcpy(dst, src + offset, first);
+        memcpy(dst + first, src, n - first);
+    }
+}
+
+int memPipeCreate()
+{
+    memRings = mmap(NULL, 2 * sizeof(MemRing), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memRings == MAP_FAILED) {
+        memRings = NULL;
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        atomic_init(&memRings[i].head, 0);
+        atomic_init(&memRings[i].tail, 0);
+        atomic_init(&memRings[i].readerWaiting, 0);
+        atomic_init(&memRings[i].writerWaiting, 0);
+        sem_init(&memRings[i].readable, 1, 0);
+        sem_init(&memRings[i].writable, 1, 0);
+    }
+    return 0;
+}
+
+static int memOpen(const char *address, int baudRate)
+{
+    if (memRings == NULL || (strcmp(address, "0") != 0 && strcmp(address, "1") != 0)) {
+        fprintf(stderr, "mem:%s: no in-memory pipe side with that number\n", address);
+        return -1;
+    }
+    memSide = atoi(address);
+    return 1;
+}
+
+static int memClose()
+{
+    return 0;
+}
+
+static int memRead(unsigned char *bytes, int nBytes)
+{
+    MemRing *ring = &memRings[1 - memSide];
+    while (1) {
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        int n = tail - head < (unsigned) nBytes ? (int) (tail - head) : nBytes;
+        if (n > 0) {
+            memCopy(bytes, ring->data, head, n, 0);
+            atomic_store(&ring->head, head + n);
+            if (atomic_exchange(&ring->writerWaiting, 0)) sem_post(&ring->writable);
+            return n;
+        }
+        // Bytes written after the flag is set are sure to post; the ones
+        // written before it are caught by looking again
+        atomic_store(&ring->readerWaiting, 1);
+        if (atomic_load(&ring->tail) != head) {
+            atomic_store(&ring->readerWaiting, 0);
+            continue;
+        }
+        if (sem_wait(&ring->readable) == -1) {
+            atomic_store(&ring->readerWaiting, 0);
+            return -1;
+        }
+    }
+}
+
+static int memWrite(const unsigned char *bytes, int nBytes)
+{
+    MemRing *ring = &memRings[memSide];
+    while (1) {
+        unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        int space = MEM_PIPE_SIZE - (int) (tail - head);
+        int n = space < nBytes ? space : nBytes;
+        if (n > 0) {
+            memCopy(ring->data, bytes, tail, n, 1);
+            atomic_store(&ring->tail, tail + n);
+            if (atomic_exchange(&ring->readerWaiting, 0)) sem_post(&ring->readable);
+            return n;
+        }
+        atomic_store(&ring->writerWaiting, 1);
+        if (atomic_load(&ring->head) != head) {
+            atomic_store(&ring->writerWaiting, 0);
+            continue;
+        }
+        if (sem_wait(&ring->writable) == -1) {
+            atomic_store(&ring->writerWaiting, 0);
+            return -1;
+        }
+    }
+}
+
+const Transport memTransport = {"mem:", memOpen, memClose, memRead, memWrite};
@@ -0,0 +1,45 @@
+// Transport backend header.
+// The serial port functions forward to one of these backends, chosen by the
+// prefix of the port name, so the link layer runs unchanged over each:
+//   /dev/ttyS10         termios serial port (no prefix)
+//   pty:/tmp/link       new pseudo-terminal; its slave is linked at the path
+//   unix:/tmp/link.sock UNIX stream socket; the first side listens
+//   fd:3                inherited descriptor, e.g. one end of socketpair()
+//   udp:5000:5001       localhost UDP, local port then peer port
+//   mem:0               side 0 or 1 of the pipe made by memPipeCreate()
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+typedef struct
+{
+    const char *prefix;
+    // Return a positive number on success or -1 on error.
+    int (*open)(const char *address, int baudRate);
+    // Return 0 on success or -1 on error.
+    int (*close)();
+    // Block until bytes arrive; may be interrupted by a signal (EINTR).
+    // Return -1 on error, otherwise the number of bytes read.
+    int (*read)(unsigned char *bytes, int nBytes);
+    // Return -1 on error, otherwise the number of bytes written.
+    int (*write)(const unsigned char *bytes, int nBytes);
+} Transport;
+
+extern const Transport termiosTransport;
+extern const Transport ptyTransport;
+extern const Transport unixTransport;
+extern const Transport fdTransport;
+extern const Transport udpTransport;
+extern const Transport memTransport;
+
+// Find the backend for a port name and store the rest of the name, which
+// the backend opens, in address.
+// Return the termios backend if no prefix matches.
+const Transport *findTransport(const char *serialPort, const char **address);
+
+// Create the shared buffers of the in-memory pipe. Must be called before
+// fork(), so that both processes see them.
+// Return 0 on success or -1 on error.
+int memPipeCreate();
+
+#endif // _TRANSPORT_H_
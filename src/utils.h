@@ -28,6 +28,44 @@
 
 #define MAX_RETRIES 3
 
+// FLAG, A, C, BCC1, stuffed payload and BCC2 (each byte at most doubled), FLAG
+#define MAX_FRAME_SIZE (2 * (MAX_PAYLOAD_SIZE + 1) + 5)
+
+// Application packet control field
+#define PKT_START 1
+#define PKT_DATA  2
+#define PKT_END   3
+#define PKT_DATA_COMPRESSED 4
+#define PKT_ZERO  5
+// A batch of files: MANIFEST, BATCH packets, END. A BATCH packet gathers
+// START and DATA packets, each one preceded by its 2-byte length; a file
+// ends with its last byte, so it has no END of its own.
+#define PKT_MANIFEST 6
+#define PKT_BATCH 7
+
+// Control packet parameter types
+#define T_FILESIZE 0
+#define T_FILENAME 1
+#define T_CODEC    2
+#define T_FILECOUNT 3  // MANIFEST and END of a batch
+
+// Codecs announced in the T_CODEC parameter of the START packet
+#define CODEC_NONE 0
+#define CODEC_LZ   1
+
+// Compress data packets when the payload looks compressible
+#ifndef USE_COMPRESSION
+#define USE_COMPRESSION 1
+#endif
+
+// Send runs of zero bytes (and file holes) as ZERO packets instead of data
+#ifndef ELIDE_ZERO_RUNS
+#define ELIDE_ZERO_RUNS 1
+#endif
+
+// Shortest zero run worth a packet of its own: ending a data packet early
+// costs a frame round trip, so only runs of about a packet are elided.
+#define ZERO_RUN_MIN 1024
 
 
 #endif // _UTILS_H_